@@ -24,69 +24,372 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "6502.h"
 
 //All memory read/write operations should assume BIG ENDIAN (Makes it easier)
 
+CPU_LOCAL struct CPUREGS registers;
+CPU_LOCAL struct CPUMEM memorymap;
+
+CPU_LOCAL unsigned long cycles;
+CPU_LOCAL unsigned long nextevent;
+
+CPU_LOCAL byte pageflags[256];
+CPU_LOCAL byte dirty[256];
+CPU_LOCAL byte (*ioread)(word address);
+CPU_LOCAL void (*iowrite)(word address, byte data);
+CPU_LOCAL void (*codewrite)(word address, int len);
+CPU_LOCAL void* iodata;
+CPU_LOCAL void* codewritedata;
+CPU_LOCAL unsigned long sharedaccesses;
+
+CPU_LOCAL int variant;
+
+CPU_LOCAL struct ARENA* arena;
+
+#ifdef STATS
+CPU_LOCAL struct CPUSTATS stats;
+#endif
+
+static CPU_LOCAL word operand; //Address of the current instruction's operand bytes, set by next()
+
+static const byte zeropage[0x100]; //Shared by every untouched page of every CPU. Lives in read-only memory, so a stray write crashes instead of leaking between CPUs
+
 byte* getpage(word address) //Get the current memory page
 {
     byte high = HIGHBYTE(address);
     byte low = LOWBYTE(address);
     byte* page;
 
-    if(high == 0) page = memorymap->zero;
-    else if(high == 1) page = memorymap->stack;
-    else page = memorymap->pages[high - 2];
+    if(high == 0) page = memorymap.zero;
+    else if(high == 1) page = memorymap.stack;
+    else page = memorymap.pages[high - 2];
 
     return page;
 }
 
-byte readb(word address)
+static void setpage(byte high, byte* page)
+{
+    if(high == 0) memorymap.zero = page;
+    else if(high == 1) memorymap.stack = page;
+    else memorymap.pages[high - 2] = page;
+}
+
+static byte* allocpage(struct ARENA* a)
+{
+    if(!a->chunks || a->used == ARENA_CHUNK)
+	{
+	    struct CHUNK* c = calloc(1, sizeof(struct CHUNK));
+
+	    if(!c) return NULL;
+	    c->next = a->chunks;
+	    a->chunks = c;
+	    a->used = 0;
+	}
+
+    return a->chunks->pages[a->used++];
+}
+
+byte* writepage(word address)
 {
     byte* page = getpage(address);
 
+    dirty[HIGHBYTE(address)] = 1; //Every write to memory comes through here, except pushes
+    if((pageflags[HIGHBYTE(address)] & PAGE_CODE) && codewrite) codewrite(address, 1);
+    if(page == zeropage) //First write to this page
+	{
+	    byte* fresh = allocpage(arena);
+
+	    if(!fresh) return NULL; //Out of memory. The page stays all zeros
+	    setpage(HIGHBYTE(address), fresh);
+	    page = fresh;
+	}
+
+    return page;
+}
+
+bool sparsemem(struct ARENA* a)
+{
+    byte* stack = allocpage(a); //Every program uses the stack, and this keeps pushb() free of checks
+    int i;
+
+    if(!stack) return false; //Out of memory. The map is left as it was
+
+    arena = a;
+    for(i = 0; i < 0x100; i++) setpage(i, (byte*) zeropage);
+    memorymap.stack = stack;
+
+    return true;
+}
+
+void arenafree(struct ARENA* a)
+{
+    while(a->chunks)
+	{
+	    struct CHUNK* c = a->chunks;
+
+	    a->chunks = c->next;
+	    free(c);
+	}
+    a->used = 0;
+}
+
+byte readb(word address)
+{
+    byte flags = pageflags[HIGHBYTE(address)];
+    byte* page;
+
+    if(flags & PAGE_SHARED) sharedaccesses++;
+    if(flags & PAGE_IO)
+	{
+	    COUNT(stats.ioaccesses++);
+	    return ioread(address);
+	}
+
+    page = getpage(address);
+
     return page[LOWBYTE(address)];
 }
 
 byte* readbp(word address)
 {
-    byte* page = getpage(address);
+    static CPU_LOCAL byte lost; //Somewhere harmless to point when there's no memory left, or no memory at all
+    byte* page;
+
+    if(pageflags[HIGHBYTE(address)] & PAGE_IO) return &lost; //Registers can't be pointed at. See modify()
+    page = writepage(address);
 
-    return &(page[LOWBYTE(address)]);
+    if(pageflags[HIGHBYTE(address)] & PAGE_SHARED) sharedaccesses++;
+    return page ? &(page[LOWBYTE(address)]) : &lost;
 }
 
-word readw(word address)
+void modify(void (*op)(byte* dest), word address)
 {
-    byte* page = getpage(address);
-    byte low = page[LOWBYTE(address)];
-    byte high;
+    byte value;
 
-    if(low == 0xff) high = page[0x00];
-    else high = page[LOWBYTE(address) + 1];
+    if(!(pageflags[HIGHBYTE(address)] & PAGE_IO))
+	{
+	    op(readbp(address));
+	    return;
+	}
 
-    return (low << 8) + high;
+    value = readb(address); //A device register sees a read and then a write, like on the real bus
+    op(&value);
+    writeb(address, value);
+}
+
+word readw(word address)
+{
+    return BtoW(readb(address), readb(WORDPLUS(address, 1)));
+}
+
+word readwp(word address)
+{
+    return BtoW(readb(address), readb(BtoW((byte) (LOWBYTE(address) + 1), HIGHBYTE(address))));
 }
 
 void writeb(word address, byte data)
 {
-    byte* page = getpage(address);
+    byte flags = pageflags[HIGHBYTE(address)];
+    byte* page;
+
+    if(flags & PAGE_SHARED) sharedaccesses++;
+    if(flags & PAGE_IO)
+	{
+	    COUNT(stats.ioaccesses++);
+	    iowrite(address, data);
+	    return;
+	}
 
-    page[LOWBYTE(address)] = data;
+    page = writepage(address);
+
+    if(page) page[LOWBYTE(address)] = data;
 }
 
-void writeblock(word start, byte* block, word len)
+static word chunk(word address, word len) //How much of len fits before the end of address's page
 {
-    int i;
-    for(i = 0; i < len; i++)
-    {
-        writeb(start + i, block[i]);
-    }
+    word left = 0x100 - LOWBYTE(address);
+
+    return (len < left) ? len : left;
+}
+
+void readblock(word start, byte* block, word len)
+{
+    word address = start;
+
+    while(len)
+	{
+	    word n = chunk(address, len);
+	    byte flags = pageflags[HIGHBYTE(address)];
+	    int i;
+
+	    if(flags & PAGE_IO)
+		{
+		    for(i = 0; i < n; i++) block[i] = readb(WORDPLUS(address, i));
+		}
+	    else
+		{
+		    if(flags & PAGE_SHARED) sharedaccesses += n;
+		    memcpy(block, getpage(address) + LOWBYTE(address), n);
+		}
+
+	    block += n;
+	    len -= n;
+	    address = WORDPLUS(address, n);
+	}
+}
+
+void writeblock(word start, const byte* block, word len)
+{
+    word address = start;
+
+    while(len)
+	{
+	    word n = chunk(address, len);
+	    byte flags = pageflags[HIGHBYTE(address)];
+	    byte* page;
+	    int i;
+
+	    if(flags & PAGE_IO)
+		{
+		    for(i = 0; i < n; i++) writeb(WORDPLUS(address, i), block[i]);
+		}
+	    else
+		{
+		    if(flags & PAGE_SHARED) sharedaccesses += n;
+		    if((flags & PAGE_CODE) && codewrite) codewrite(address, n);
+		    page = writepage(address);
+		    if(page) memcpy(page + LOWBYTE(address), block, n);
+		}
+
+	    block += n;
+	    len -= n;
+	    address = WORDPLUS(address, n);
+	}
+}
+
+void fillblock(word start, byte value, word len)
+{
+    word address = start;
+
+    while(len)
+	{
+	    word n = chunk(address, len);
+	    byte flags = pageflags[HIGHBYTE(address)];
+	    byte* page;
+	    int i;
+
+	    if(flags & PAGE_IO)
+		{
+		    for(i = 0; i < n; i++) writeb(WORDPLUS(address, i), value);
+		}
+	    else
+		{
+		    if(flags & PAGE_SHARED) sharedaccesses += n;
+		    if((flags & PAGE_CODE) && codewrite) codewrite(address, n);
+		    page = writepage(address);
+		    if(page) memset(page + LOWBYTE(address), value, n);
+		}
+
+	    len -= n;
+	    address = WORDPLUS(address, n);
+	}
+}
+
+int compareblock(word start, const byte* block, word len)
+{
+    word address = start;
+
+    while(len)
+	{
+	    word n = chunk(address, len);
+	    byte flags = pageflags[HIGHBYTE(address)];
+	    int i, diff;
+
+	    if(flags & PAGE_IO)
+		{
+		    for(i = 0; i < n; i++)
+			{
+			    diff = readb(WORDPLUS(address, i)) - block[i];
+			    if(diff) return diff;
+			}
+		}
+	    else
+		{
+		    if(flags & PAGE_SHARED) sharedaccesses += n;
+		    diff = memcmp(getpage(address) + LOWBYTE(address), block, n);
+		    if(diff) return diff;
+		}
+
+	    block += n;
+	    len -= n;
+	    address = WORDPLUS(address, n);
+	}
+
+    return 0;
+}
+
+const byte* readspan(word start, word* len)
+{
+    const byte* first;
+    word n = 0;
+
+    if(pageflags[HIGHBYTE(start)] & PAGE_IO)
+	{
+	    *len = 0;
+	    return NULL;
+	}
+
+    first = getpage(start) + LOWBYTE(start);
+    while(n < *len)
+	{
+	    word address = WORDPLUS(start, n);
+	    word c = chunk(address, *len - n);
+	    byte flags = pageflags[HIGHBYTE(address)];
+
+	    if((flags & PAGE_IO) || getpage(address) + LOWBYTE(address) != first + n) break;
+	    if(flags & PAGE_SHARED) sharedaccesses += c;
+	    n += c;
+	}
+
+    *len = n;
+    return first;
+}
+
+byte* writespan(word start, word* len)
+{
+    byte* first = NULL;
+    word n = 0;
+
+    while(n < *len)
+	{
+	    word address = WORDPLUS(start, n);
+	    word c = chunk(address, *len - n);
+	    byte flags = pageflags[HIGHBYTE(address)];
+	    byte* page;
+
+	    if(flags & PAGE_IO) break;
+	    if((flags & PAGE_CODE) && codewrite) codewrite(address, c);
+
+	    page = writepage(address); //Gives sparse pages their storage, which can move them
+	    if(!page) break;
+	    if(!first) first = page + LOWBYTE(address);
+	    else if(page + LOWBYTE(address) != first + n) break;
+
+	    if(flags & PAGE_SHARED) sharedaccesses += c;
+	    n += c;
+	}
+
+    *len = n;
+    return first;
 }
 
 void pushb(byte b)
 {
-    memorymap->stack[registers.sp--} = b;
+    dirty[1] = 1;
+    memorymap.stack[registers.sp--] = b;
 }
 
 void pushw(word w)
@@ -102,11 +405,7 @@ void pushp(struct PFLAGS p, bool b)
 
 byte pullb()
 {
-    byte b = memorymap->stack[registers.sp];
-    memorymap->stack[registers.sp] = 0;
-    registers.sp++;
-
-    return b;
+    return memorymap.stack[++registers.sp];
 }
 
 word pullw()
@@ -146,26 +445,60 @@ void reset()
 
 void interrupt(int type)
 {
-    if(type == 0 && !registers.p.i) //If it's a maskable interrupt
+    if(type == 0 && registers.p.i) return; //Maskable interrupts are ignored while I is set
+    COUNT(stats.interrupts++);
+    if(busexact)
 	{
-	    pushw(registers.pc);
-	    pushp(registers.p, 0);
-	    jumpi(0xfeff);
-	}
-    else //If it's non-maskable
-	{
-	    pushw(registers.pc);
-	    pushp(registers.p, (type == 2)?1:0); //Bit 4 is only set if interrupt was called with BRK
-	    jumpi(0xfaff);
+	    businterrupt(type);
+	    return;
 	}
+
+    pushw(registers.pc);
+    pushp(registers.p, (type == 2)?1:0); //Bit 4 is only set if interrupt was called with BRK
+    registers.p.i = true;
+    if(variant == CPU_65C02) registers.p.d = false; //The CMOS chip clears decimal mode on every interrupt
+
+    if(type == 1) jumpi(0xfaff); //NMI has its own vector, IRQ and BRK share one
+    else jumpi(0xfeff);
+    if(type != 2) cycles += 7; //BRK's 7 are in its table entry. Same as businterrupt() spends on the bus
 }
 
 void next()
 {
-    opcode o;
-    
-    o.op();
-    incPC(o.len);
+    word pc = registers.pc;
+    byte code = readb(pc);
+    opcode* o = &(optable[code]);
+
+    if(!o->op) o = &(optable[0xea]); //Opcodes the table doesn't know act as NOP
+    COUNT(stats.retired++);
+    COUNT(stats.opcodes[code]++);
+
+    registers.pc = WORDPLUS(pc, o->len); //Handlers see PC at the next instruction, like the real CPU
+    operand = WORDPLUS(pc, 1);
+    o->op();
+    cycles += o->time;
+}
+
+int nextops(opcode* const* ops, int count, unsigned long end, const bool* stop)
+{
+    int i;
+
+    for(i = 0; i < count && cycles < end && !*stop; i++)
+	{
+	    word pc = registers.pc;
+	    opcode* o = ops[i];
+
+	    COUNT(stats.retired++);
+	    COUNT(stats.opcodes[o->code]++);
+
+	    registers.pc = WORDPLUS(pc, o->len);
+	    operand = WORDPLUS(pc, 1);
+	    o->op();
+	    cycles += o->time;
+	    if(nextevent && nextevent < end) end = nextevent; //A device may have scheduled something sooner, as in run()
+	}
+
+    return i;
 }
 
 void start()
@@ -174,44 +507,161 @@ void start()
     next();
 }
 
-void ADC(byte src, byte* dest)
+static bool branchtaken(byte code, struct PFLAGS p) //Whether a branch opcode would be taken with the flags p (False for anything else)
 {
-    registers.p.v = (src | *dest < 0x80 && src + *dest >= 0x80) || //If src + *dest > 127
-                    (src & *dest >= 0x80 && src + *dest < 0x80) //If src + *dest < -128
-    
-    if(registers.p.d)
+    switch(code)
 	{
-	    byte low = LOWNIBBLE(src) + LOWNIBBLE(*dest);
-	    byte high = HIGHNIBBLE(src) + HIGHNIBBLE(*dest);
+	case 0x10: return !p.n; //BPL
+	case 0x30: return p.n; //BMI
+	case 0x50: return !p.v; //BVC
+	case 0x70: return p.v; //BVS
+	case 0x90: return !p.c; //BCC
+	case 0xb0: return p.c; //BCS
+	case 0xd0: return !p.z; //BNE
+	case 0xf0: return p.z; //BEQ
+	case 0x80: return variant == CPU_65C02; //BRA, a NOP with an operand on the NMOS chips
+	}
 
-	    if(low >= 10)
-		{
-		    high += low - (low % 10);
-		    low %= 10;
-		}
-	    if(high >= 10)
-		{
-		    registers.p.c = true;
-		    high %= 10;
-		}
+    return false;
+}
+
+static int takentime(byte code, word at, word target) //Cycles for the taken branch at at (See branch())
+{
+    word next = WORDPLUS(at, 2);
+
+    return optable[code].time + ((HIGHBYTE(next) != HIGHBYTE(target)) ? 2 : 1);
+}
 
-	    *dest = (high << 4) + low;
+static bool stable(word address) //Reading address has no side effects and can't change until the next event
+{
+    byte flags = pageflags[HIGHBYTE(address)];
+
+    return !(flags & PAGE_IO) || (flags & PAGE_STABLE);
+}
+
+/*
+ * Recognises the loops firmware sits in while it waits for an interrupt:
+ *   JMP *
+ *   Bxx * (With the branch taken, so BRA * too on the 65C02)
+ *   loop: LDA/LDX/LDY/BIT status; Bxx loop (With the branch taken for the value in status)
+ * Nothing inside them can change state until an interrupt or device event, so every iteration is identical.
+ */
+int idleloop()
+{
+    word pc = registers.pc;
+    byte code = readb(pc);
+    struct PFLAGS p = registers.p;
+    word address;
+    byte value;
+    int len, time;
+
+    if(code == 0x4c && readw(WORDPLUS(pc, 1)) == pc) return optable[code].time; //JMP *
+    if(branchtaken(code, p)) return ((signed char) readb(WORDPLUS(pc, 1)) == -2) ? takentime(code, pc, pc) : 0; //Bxx *
+
+    switch(code)
+	{
+	case 0xa5: case 0xa6: case 0xa4: case 0x24: //LDA, LDX, LDY, BIT zero page
+	    address = BtoW(readb(WORDPLUS(pc, 1)), 0);
+	    break;
+	case 0xad: case 0xae: case 0xac: case 0x2c: //LDA, LDX, LDY, BIT absolute
+	    address = readw(WORDPLUS(pc, 1));
+	    break;
+	default:
+	    return 0;
+	}
+
+    if(!stable(address)) return 0;
+    value = readb(address);
+    len = optable[code].len;
+    time = optable[code].time;
+
+    if(code == 0x24 || code == 0x2c)
+	{
+	    p.z = ((registers.ac & value) == 0);
+	    p.n = (value & 0x80);
+	    p.v = (value & 0x40);
 	}
     else
 	{
-	    int result_safe = src + *dest;
+	    p.z = (value == 0);
+	    p.n = NEGATIVE(value);
+	}
+
+    code = readb(WORDPLUS(pc, len));
+    if(!branchtaken(code, p) || (signed char) readb(WORDPLUS(pc, len + 1)) != -(len + 2)) return 0;
+
+    return time + takentime(code, WORDPLUS(pc, len), pc);
+}
+
+void idleskip(word pc, unsigned long end)
+{
+    unsigned long loops;
+    word top = registers.pc;
+    int looptime;
 
-	    if(result_safe > 0xff)
+    if(BIG(registers.pc) > BIG(pc) || cycles >= end) return; //Only backward jumps can close a loop, and only before end
+
+    looptime = idleloop();
+    if(!looptime) return;
+
+    loops = (end - cycles) / looptime; //Whole iterations only, the rest is run normally so we stop where the CPU would
+    if(loops == 0) return;
+
+    do next(); while(registers.pc != top); //One real iteration leaves the registers exactly as the skipped ones would
+    cycles += (loops - 1) * looptime;
+    COUNT(stats.idlecycles += (loops - 1) * looptime);
+}
+
+unsigned long run(unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    if(busexact) return runbus(n);
+    if(nextevent && nextevent < end) end = nextevent;
+
+    while(cycles < end)
+	{
+	    word pc = registers.pc;
+
+	    next();
+	    if(nextevent && nextevent < end) end = nextevent; //A device may have scheduled something sooner (See events.h)
+	    idleskip(pc, end);
+	}
+
+    return cycles - begin;
+}
+
+void ADC(byte src, byte* dest)
+{
+    int result = *dest + src + registers.p.c;
+
+    registers.p.v = !((*dest ^ src) & 0x80) && ((*dest ^ result) & 0x80); //Both operands had the same sign and the result doesn't
+    registers.p.z = ((result & 0xff) == 0); //NMOS takes Z from the binary sum, even in decimal mode
+
+    if(registers.p.d)
+	{
+	    int low = LOWNIBBLE(*dest) + LOWNIBBLE(src) + registers.p.c;
+	    int high = HIGHNIBBLE(*dest) + HIGHNIBBLE(src);
+
+	    if(low > 9)
 		{
-		    registers.p.c = true;
-		    result_safe &= 0xff;
+		    low += 6;
+		    high++;
 		}
+	    registers.p.n = (high & 0x8); //N and V come from the half-adjusted result
+	    registers.p.v = !((*dest ^ src) & 0x80) && ((*dest ^ (high << 4)) & 0x80);
+	    if(high > 9) high += 6;
 
-	    *dest = (byte) result_safe;
+	    registers.p.c = (high > 0xf);
+	    *dest = (byte) ((high << 4) + (low & 0xf));
+	}
+    else
+	{
+	    registers.p.c = (result > 0xff);
+	    *dest = (byte) result;
+	    registers.p.n = NEGATIVE(*dest);
 	}
-    /********************/
-    registers.p.z = (*dest == 0);
-    registers.p.n = NEGATIVE(*dest);
 }
 
 void AND(byte src, byte* dest)
@@ -235,23 +685,21 @@ void ASL(byte* dest)
 
 void BIT(byte b1, byte b2)
 {
-    byte result = b1 & b2;
-    /********************/
-    registers.p.z = (result == 0);
-    registers.p.n = (result & 0x80);
-    registers.p.v = (result & 0x40);
+    registers.p.z = ((b1 & b2) == 0);
+    registers.p.n = (b2 & 0x80); //N and V are copied straight from memory
+    registers.p.v = (b2 & 0x40);
 }
 
 void CMP(byte b1, byte b2)
 {
     registers.p.c = (b1 >= b2);
     registers.p.z = (b1 == b2);
-    registers.p.n = NEGATIVE(b1);
+    registers.p.n = NEGATIVE((byte) (b1 - b2));
 }
 
 void DEC(byte* dest)
 {
-    *dest--;
+    (*dest)--;
     /********************/
     registers.p.z = (*dest == 0);
     registers.p.n = NEGATIVE(*dest);
@@ -267,7 +715,7 @@ void EOR(byte src, byte* dest)
 
 void INC(byte* dest)
 {
-    *dest++;
+    (*dest)++;
     /********************/
     registers.p.z = (*dest == 0);
     registers.p.n = NEGATIVE(*dest);
@@ -275,13 +723,11 @@ void INC(byte* dest)
 
 void LSR(byte* dest)
 {
-    int dest_safe = (int) *dest >> 7;
-    
-    *dest = (byte) dest_safe;
+    registers.p.c = (*dest & 0x1);
+    *dest >>= 1;
     /********************/
     registers.p.z = (*dest == 0);
     registers.p.n = NEGATIVE(*dest);
-    registers.p.c = (dest_safe & 0x80);
 }
 
 void ORA(byte src, byte* dest)
@@ -306,55 +752,41 @@ void ROL(byte* dest)
 
 void ROR(byte* dest)
 {
-    int dest_safe = (int) *dest >> 1;
+    bit carry = (*dest & 0x1);
     
-    *dest = (byte) dest_safe + (registers.p.c << 7);
+    *dest = (byte) ((*dest >> 1) + (registers.p.c << 7));
     /********************/
-    registers.p.c = (dest_safe & 0x80);
+    registers.p.c = carry;
     registers.p.z = (*dest == 0);
     registers.p.n = NEGATIVE(*dest);
 }
 
-void SBC(byte src, byte* dest) //I think it will work, but if it crashes and burns, this is probably the issue
+void SBC(byte src, byte* dest)
 {
-    registers.p.v = (src | *dest < 0x80 && src + *dest >= 0x80) || //If src + *dest > 127
-	            (src & *dest >= 0x80 && src + *dest < 0x80); //If src + *dest < -128
-    
-    registers.p.c = true;
-    
+    int borrow = !registers.p.c;
+    int result = *dest - src - borrow;
+
+    registers.p.v = ((*dest ^ src) & 0x80) && ((*dest ^ result) & 0x80); //Operands had different signs and the result flipped
+    registers.p.c = (result >= 0);
+    registers.p.z = ((result & 0xff) == 0); //All flags come from the binary difference, even in decimal mode
+    registers.p.n = NEGATIVE(result);
+
     if(registers.p.d)
 	{
-	    byte low = LOWNIBBLE(*dest) - LOWNIBBLE(src);
-	    byte high = HIGHNIBBLE(*dest) - HIGHNIBBLE(src);
+	    int low = LOWNIBBLE(*dest) - LOWNIBBLE(src) - borrow;
+	    int high = HIGHNIBBLE(*dest) - HIGHNIBBLE(src);
 
-	    if(low > 0xf)
+	    if(low < 0)
 		{
+		    low -= 6;
 		    high--;
-		    low &= 0xf;
-		}
-	    if(high > 0xf)
-		{
-		    registers.p.c = false;
-		    high &= 0xf;
 		}
+	    if(high < 0) high -= 6;
 
-	    *dest = (high << 4) + low;
+	    result = (high << 4) + (low & 0xf);
 	}
-    else
-	{
-	    int result_safe = *dest - src;
 
-	    if(result_safe > 0xff)
-		{
-		    registers.p.c = false;
-		    result_safe &= 0xff;
-		}
-
-	    *dest = (byte) result_safe;
-	}
-    /********************/
-    registers.p.z = (*dest == 0);
-    registers.p.n = NEGATIVE(*dest);
+    *dest = (byte) result;
 }
 
 void MOV(byte src, byte* dest, bool flags)
@@ -368,76 +800,189 @@ void MOV(byte src, byte* dest, bool flags)
 	}
 }
 
-//Here we go!
-void ADCimmf() { ADC(readb(registers.pc + 1), &(registers.ac)); }
-void ADCzpf() { ADC(readb(readb(registers.pc + 1)), &(registers.ac)); }
-void ADCzpxf() { ADC(readb(readb(registers.pc + 1) + registers.x), &(registers.ac)); }
-void ADCabsf() { ADC(readb(readw(WORDPLUS(registers.pc, 1))), &(registers.ac)); }
-void ADCabsxf() { ADC(readb(readw(WORDPLUS(registers.pc, 1)) + registers.x), &(registers.ac)); }
-void ADCabsyf() { ADC(readb(readw(WORDPLUS(registers.pc, 1)) + registers.y), &(registers.ac)); }
-void ADCindxf() { ADC(readb(readw(readb(registers.pc + 1) + registers.x)), &(registers.ac)); }
-void ADCindyf() { ADC(readb(WORDPLUS(readw(readb(registers.pc + 1)) + registers.y)), &(registers.ac)); }
-
-void ANDimmf() { AND(readb(registers.pc + 1), &(registers.ac)); }
-void ANDzpf() { AND(readb(readb(registers.pc + 1)), &(registers.ac)); }
-void ANDzpxf() { AND(readb(readb(registers.pc + 1) + registers.x), &(registers.ac)); }
-void ANDabsf() { AND(readb(readw(WORDPLUS(registers.pc, 1))), &(registers.ac)); }
-void ANDabsxf() { AND(readb(readw(WORDPLUS(registers.pc, 1)) + registers.x), &(registers.ac)); }
-void ANDabsyf() { AND(readb(readw(WORDPLUS(registers.pc, 1)) + registers.y), &(registers.ac)); }
-void ANDindxf() { AND(readb(readw(WORDPLUS(readb(registers.pc + 1), registers.x))), &(registers.ac)); }
-void ANDindyf() { AND(readb(readw(readb(registers.pc + 1)) + registers.y), &(registers.ac)); }
+void SLO(byte* dest) { ASL(dest); ORA(*dest, &(registers.ac)); }
+void RLA(byte* dest) { ROL(dest); AND(*dest, &(registers.ac)); }
+void SRE(byte* dest) { LSR(dest); EOR(*dest, &(registers.ac)); }
+void RRA(byte* dest) { ROR(dest); ADC(*dest, &(registers.ac)); }
+void DCP(byte* dest) { (*dest)--; CMP(registers.ac, *dest); }
+void ISC(byte* dest) { (*dest)++; SBC(*dest, &(registers.ac)); }
+
+void LAX(byte src, byte* dest) { MOV(src, dest, true); registers.x = src; }
+void ANC(byte src, byte* dest) { AND(src, dest); registers.p.c = registers.p.n; }
+void ALR(byte src, byte* dest) { AND(src, dest); LSR(dest); }
+
+void ARR(byte src, byte* dest)
+{
+    AND(src, dest);
+    ROR(dest);
+    /********************/
+    registers.p.c = (*dest & 0x40);
+    registers.p.v = ((*dest >> 6) ^ (*dest >> 5)) & 0x1;
+}
+
+void SBX(byte src, byte* dest)
+{
+    int result = (registers.ac & *dest) - src;
+
+    *dest = (byte) result;
+    /********************/
+    registers.p.c = (result >= 0);
+    registers.p.z = (*dest == 0);
+    registers.p.n = NEGATIVE(*dest);
+}
+
+byte SAX() { return registers.ac & registers.x; }
+
+void ADCC(byte src, byte* dest)
+{
+    ADC(src, dest);
+    /********************/
+    registers.p.z = (*dest == 0); //Unlike NMOS, flags come from the decimal result
+    registers.p.n = NEGATIVE(*dest);
+}
+
+void SBCC(byte src, byte* dest)
+{
+    SBC(src, dest);
+    /********************/
+    registers.p.z = (*dest == 0);
+    registers.p.n = NEGATIVE(*dest);
+}
+
+void TSB(byte* dest) { registers.p.z = ((registers.ac & *dest) == 0); *dest |= registers.ac; }
+void TRB(byte* dest) { registers.p.z = ((registers.ac & *dest) == 0); *dest &= ~registers.ac; }
+
+byte STZ() { return 0; }
+
+static inline word indexed(word base, byte index, bool read) //Reads pay a cycle when indexing crosses a page, writes and RMW always take it (It's in their time)
+{
+    word address = WORDPLUS(base, index);
+
+    if(read && HIGHBYTE(address) != HIGHBYTE(base)) cycles++;
+    return address;
+}
+
+//Addressing modes. Each returns the effective address of the current instruction's operand. read is false for stores and RMW
+static inline word addrimm(bool read) { return operand; }
+static inline word addrzp(bool read) { return BtoW(readb(operand), 0); }
+static inline word addrzpx(bool read) { return BtoW((byte) (readb(operand) + registers.x), 0); } //Indexing wraps around inside the zero page
+static inline word addrzpy(bool read) { return BtoW((byte) (readb(operand) + registers.y), 0); }
+static inline word addrabs(bool read) { return readw(operand); }
+static inline word addrabsx(bool read) { return indexed(readw(operand), registers.x, read); }
+static inline word addrabsy(bool read) { return indexed(readw(operand), registers.y, read); }
+static inline word addrindx(bool read) { return readwp(BtoW((byte) (readb(operand) + registers.x), 0)); }
+static inline word addrindy(bool read) { return indexed(readwp(addrzp(read)), registers.y, read); }
+static inline word addrizp(bool read) { return readwp(addrzp(read)); }
+
+//Handler generators (See OPCODES in 6502.h)
+#define ALU(name, mode, reg) void name##mode##f() { name(readb(addr##mode(true)), &(registers.reg)); }
+#define LOAD(name, mode, reg) void name##mode##f() { MOV(readb(addr##mode(true)), &(registers.reg), true); }
+#define COMPARE(name, mode, reg) void name##mode##f() { CMP(registers.reg, readb(addr##mode(true))); }
+#define TEST(name, mode, reg) void name##mode##f() { BIT(registers.reg, readb(addr##mode(true))); }
+#define MODIFY(name, mode, reg) void name##mode##f() { modify(&(name), addr##mode(false)); }
+#define STORE(name, mode, reg) void name##mode##f() { writeb(addr##mode(false), registers.reg); }
+#define WRITE(name, mode, reg) void name##mode##f() { writeb(addr##mode(false), name()); }
+#define SKIP(name, mode, reg) void name##mode##f() { readb(addr##mode(true)); }
+#define IMPLIED(name, mode, reg)
+
+#define HANDLER(name, mode, kind, reg, c, l, t) kind(name, mode, reg)
+OPCODES(HANDLER) //Here we go!
+ILLEGAL_OPCODES(HANDLER)
+CMOS_OPCODES(HANDLER)
+#undef HANDLER
+
+//Later entries replace earlier ones for the same opcode, which is how the variant lists override OPCODES
+#define ENTRY(name, mode, kind, reg, c, l, t) [c] = { .code = c, .op = &(name##mode##f), .len = l, .time = t },
+static opcode nmostable[256] = { OPCODES(ENTRY) };
+static opcode illegaltable[256] = { OPCODES(ENTRY) ILLEGAL_OPCODES(ENTRY) };
+static opcode cmostable[256] = { OPCODES(ENTRY) CMOS_OPCODES(ENTRY) };
+#undef ENTRY
+
+struct INSTRUCTIONS_EX instructions = { .nmos = nmostable, .illegal = illegaltable, .cmos = cmostable };
+CPU_LOCAL opcode* optable = nmostable;
+
+void savecontext(struct CPUCONTEXT* c)
+{
+    c->registers = registers;
+    c->memorymap = memorymap;
+    c->cycles = cycles;
+    c->nextevent = nextevent;
+    memcpy(c->pageflags, pageflags, sizeof(pageflags));
+    memcpy(c->dirty, dirty, sizeof(dirty));
+    c->ioread = ioread;
+    c->iowrite = iowrite;
+    c->codewrite = codewrite;
+    c->iodata = iodata;
+    c->codewritedata = codewritedata;
+    c->sharedaccesses = sharedaccesses;
+    c->variant = variant;
+    c->arena = arena;
+    c->busexact = busexact;
+    c->busaccess = busaccess;
+#ifdef STATS
+    c->stats = stats;
+#endif
+}
+
+void loadcontext(const struct CPUCONTEXT* c)
+{
+    registers = c->registers;
+    memorymap = c->memorymap;
+    cycles = c->cycles;
+    nextevent = c->nextevent;
+    memcpy(pageflags, c->pageflags, sizeof(pageflags));
+    memcpy(dirty, c->dirty, sizeof(dirty));
+    ioread = c->ioread;
+    iowrite = c->iowrite;
+    codewrite = c->codewrite;
+    iodata = c->iodata;
+    codewritedata = c->codewritedata;
+    sharedaccesses = c->sharedaccesses;
+    arena = c->arena;
+    busaccess = c->busaccess;
+#ifdef STATS
+    stats = c->stats;
+#endif
+
+    setvariant(c->variant);
+    setbusmode(c->busexact);
+}
+
+void setvariant(int v)
+{
+    variant = v;
+
+    if(v == CPU_NMOSX) optable = instructions.illegal;
+    else if(v == CPU_65C02) optable = instructions.cmos;
+    else optable = instructions.nmos;
+}
+
+static inline void jumpby(signed char offset) //A taken branch costs a cycle, and another if it lands in a different page
+{
+    word next = registers.pc;
+
+    registers.pc = WORDPLUS(next, offset);
+    cycles += (HIGHBYTE(registers.pc) != HIGHBYTE(next)) ? 2 : 1;
+}
+
+static inline void branch(bool taken)
+{
+    if(taken) jumpby((signed char) readb(operand));
+    COVER(operand, registers.pc); //Both ways out of a branch count as edges
+}
 
 void ASLaccf() { ASL(&(registers.ac)); }
-void ASLzpf() { ASL(readbp(readb(registers.pc + 1))); }
-void ASLzpxf() { ASL(readbp(readb(registers.pc + 1) + registers.x)); }
-void ASLabsf() { ASL(readbp(readw_o(registers.pc, 1))); }
-void ASLabsxf() { ASL(readbp(readw_o(registers.pc, 1) + registers.x)); }
-
-void BITzpf() { BIT(readb(readb(registers.pc + 1))); }
-void BITabsf() { BIT(readb(readw_o(registers.pc, 1))); }
-
-//If only functions were first class objects in C... this would be much easier!
-void BPLf() { if(!registers.p.n) incPC(readb(registers.pc + 1)); }
-void BMIf() { if(registers.p.n) incPC(readb(registers.pc + 1)); }
-void BVCf() { if(!registers.p.v) incPC(readb(registers.pc + 1)); }
-void BVSf() { if(registers.p.v) incPC(readb(registers.pc + 1)); }
-void BCCf() { if(!registers.p.c) incPC(readb(registers.pc + 1)); }
-void BCSf() { if(registers.p.c) incPC(readb(registers.pc + 1)); }
-void BNEf() { if(!registers.p.z) incPC(readb(registers.pc + 1)); }
-void BEQf() { if(registers.p.z) incPC(readb(registers.pc + 1)); }
-
-void BRKf() { interrupt(2); }
-
-void CMPimmf() { CMP(readb(registers.pc + 1), registers.ac); }
-void CMPzpf() { CMP(readb(readb(registers.pc + 1)), registers.ac); }
-void CMPzpxf() { CMP(readb(readb(registers.pc + 1) + registers.x), registers.ac); }
-void CMPabsf() { CMP(readb(readw_o(registers.pc, 1)), registers.ac); }
-void CMPabsxf() { CMP(readb(readw_o(registers.pc, 1) + registers.x), registers.ac); }
-void CMPabsyf() { CMP(readb(readw_o(registers.pc, 1) + registers.y), registers.ac); }
-void CMPindxf() { CMP(readb(readw(readb(registers.pc + 1) + registers.x)), registers.ac); }
-void CMPindyf() { CMP(readb(readw(readb(registers.pc + 1)) + registers.y), registers.ac); }
-
-void CPXimmf() { CMP(readb(registers.pc + 1), registers.x); }
-void CPXzpf() { CMP(readb(readb(registers.pc + 1)), registers.x); }
-void CPXabsf() { CMP(readb(readw_o(registers.pc, 1)), registers.x); }
-
-void CPYimmf() { CMP(readb(registers.pc + 1), registers.y); }
-void CPYzpf() { CMP(readb(readb(registers.pc + 1)), registers.y); }
-void CPYabsf() { CMP(readb(readw_o(registers.pc, 1)), registers.y); }
-
-void DECzpf() { DEC(readbp(readb(registers.pc + 1))); }
-void DECzpxf() { DEC(readbp(readb(registers.pc + 1) + registers.x)); }
-void DECabsf() { DEC(readbp(readw_o(registers.pc, 1))); }
-void DECabsxf() { DEC(readbp(readw_o(registers.pc, 1) + registers.x)); }
-
-void EORimmf() { EOR(readb(registers.pc + 1), &(registers.ac)); }
-void EORzpf() { EOR(readb(readb(registers.pc + 1)), &(registers.ac)); }
-void EORzpxf() { EOR(readb(readb(registers.pc + 1) + registers.x), &(registers.ac)); }
-void EORabsf() { EOR(readb(readw_o(registers.pc, 1)), &(registers.ac)); }
-void EORabsxf() { EOR(readb(readw_o(registers.pc, 1) + registers.x), &(registers.ac)); }
-void EORabsyf() { EOR(readb(readw_o(registers.pc, 1) + registers.y), &(registers.ac)); }
-void EORindxf() { EOR(readb(readw(readb(registers.pc + 1) + registers.x)), &(registers.ac)); }
-void EORindyf() { EOR(readb(readw(readb(registers.pc + 1)) + registers.y), &(registers.ac)); }
+
+void BPLf() { branch(!registers.p.n); }
+void BMIf() { branch(registers.p.n); }
+void BVCf() { branch(!registers.p.v); }
+void BVSf() { branch(registers.p.v); }
+void BCCf() { branch(!registers.p.c); }
+void BCSf() { branch(registers.p.c); }
+void BNEf() { branch(!registers.p.z); }
+void BEQf() { branch(registers.p.z); }
+
+void BRKf() { registers.pc = WORDPLUS(registers.pc, 1); interrupt(2); } //BRK skips a padding byte
 
 void CLCf() { registers.p.c = false; }
 void SECf() { registers.p.c = true; }
@@ -447,76 +992,54 @@ void CLVf() { registers.p.v = false; }
 void CLDf() { registers.p.d = false; }
 void SEDf() { registers.p.d = true; }
 
-void INCzpf() { INC(readbp(readb(registers.pc + 1))); }
-void INCzpxf() { INC(readbp(readb(registers.pc + 1) + registers.x)); }
-void INCabsf() { INC(readbp(readw_o(registers.pc, 1))); }
-void INCabsxf() { INC(readbp(readw_o(registers.pc, 1) + registers.x)); }
-
-void JMPabsf() { registers.pc = readw_o(registers.pc, 1); }
-void JMPindf() { registers.pc = readw(readb(readw_o(registers.pc, 1)) << 8 + (readb(registers.pc + 1) == 0xff) ?
-				      readb(readw_o(registers.pc, 1) - 0xff) :
-				      readb(readw_o(registers.pc, 1) + 1)); }
-
-void JSRf() { pushw(registers.pc); registers.pc = readw_o(registers.pc, 1); }
-
-void LDAimmf() { MOV(readb(registers.pc + 1), &(registers.ac), true); }
-void LDAzpf() { MOV(readb(readb(registers.pc + 1)), &(registers.ac), true); }
-void LDAzpxf() { MOV(readb(readb(registers.pc + 1) + registers.x), &(registers.ac), true); }
-void LDAabsf() { MOV(readb(readw_o(registers.pc, 1)), &(registers.ac), true); }
-void LDAabsxf() { MOV(readb(readw_o(registers.pc, 1) + registers.x), &(registers.ac), true); }
-void LDAabsyf() { MOV(readb(readw_o(registers.pc, 1) + registers.y), &(registers.ac), true); }
-void LDAindxf() { MOV(readb(readb(readb(registers.pc + 1) + registers.x)), &(registers.ac), true); }
-void LDAindyf() { MOV(readb(readb(readb(registers.pc + 1)) + registers.y), &(registers.ac), true); }
-
-void LDXimmf() { MOV(readb(registers.pc + 1), &(registers.x), true); }
-void LDXzpf() { MOV(readb(readb(registers.pc + 1)), &(registers.x), true); }
-void LDXzpyf() { MOV(readb(readb(registers.pc + 1) + registers.y), &(registers.x), true); }
-void LDXabsf() { MOV(readb(readw_o(registers.pc, 1)), &(registers.x), true); }
-void LDXabsyf() { MOV(readb(readw_o(registers.pc, 1) + registers.y), &(registers.x), true); }
-
-void LDYimmf() { MOV(readb(registers.pc + 1), &(registers.y), true); }
-void LDYzpf() { MOV(readb(readb(registers.pc + 1)), &(registers.y), true); }
-void LDYzpxf() { MOV(readb(readb(registers.pc + 1) + registers.x), &(registers.y), true); }
-void LDYabsf() { MOV(readb(readw_o(registers.pc, 1)), &(registers.y), true); }
-void LDYabsxf() { MOV(readb(readw_o(registers.pc, 1) + registers.x), &(registers.y), true); }
+void JMPabsf() { registers.pc = addrabs(false); COVER(operand, registers.pc); }
+void JMPindf() { registers.pc = readwp(addrabs(false)); COVER(operand, registers.pc); } //The pointer never crosses a page, just like the real (buggy) thing
+
+void JSRf() { pushw(WORDPLUS(registers.pc, -1)); registers.pc = addrabs(false); COVER(operand, registers.pc); } //Pushes the address of its own last byte
 
 void LSRaccf() { LSR(&(registers.ac)); }
-void LSRzpf() { LSR(readbp(readb(registers.pc + 1))); }
-void LSRzpxf() { LSR(readbp(readb(registers.pc + 1) + registers.x)); }
-void LSRabsf() { LSR(readbp(readw_o(registers.pc, 1))); }
-void LSRabsxf() { LSR(readbp(readw_o(registers.pc, 1) + registers.x)); }
 
 void NOPf() { return; } //What did you expect?
 
-void ORAimmf() { ORA(readb(registers.pc + 1), &(registers.ac)); }
-void ORAzpf() { ORA(readb(readb(registers.pc + 1)), &(registers.ac)); }
-void ORAzpxf() { ORA(readb(readb(registers.pc + 1) + registers.x), &(registers.ac)); }
-void ORAabsf() { ORA(readb(readw_o(registers.pc + 1)), &(registers.ac)); }
-void ORAabsxf() { ORA(readb(readw_o(registers.pc, 1) + registers.x), &(registers.ac)); }
-void ORAabsyf() { ORA(readb(readw_o(registers.pc, 1) + registers.y), &(registers.ac)); }
-void ORAindxf() { ORA(readb(readb(readb(registers.pc + 1) + registers.x)), &(registers.ac)); }
-void ORAindyf() { ORA(readb(readb(readb(registers.pc + 1)) + registers.y), &(registers.ac)); }
-
-void TAXf() { MOV(registers.ac, &(registers.x)); }
-void TXAf() { MOV(registers.x, &(registers.ac)); }
+void TAXf() { MOV(registers.ac, &(registers.x), true); }
+void TXAf() { MOV(registers.x, &(registers.ac), true); }
 void DEXf() { DEC(&(registers.x)); }
 void INXf() { INC(&(registers.x)); }
-void TAYf() { MOV(registers.ac, &(registers.y)); }
-void TYAf() { MOV(registers.y, &(registers.ac)); }
+void TAYf() { MOV(registers.ac, &(registers.y), true); }
+void TYAf() { MOV(registers.y, &(registers.ac), true); }
 void DEYf() { DEC(&(registers.y)); }
-void INYf() { DEC(&(registers.y)); }
+void INYf() { INC(&(registers.y)); }
 
 void ROLaccf() { ROL(&(registers.ac)); }
-void ROLzpf() { ROL(readbp(readb(registers.pc + 1))); }
-void ROLzpxf() { ROL(readbp(readb(registers.pc + 1) + registers.x)); }
-void ROLabsf() { ROL(readbp(readw(registers.pc + 1))); }
-void ROLabsxf() { ROL(readbp(readw(registers.pc + 1) + registers.x)); }
-
 void RORaccf() { ROR(&(registers.ac)); }
-void RORzpf() { ROR(readbp(readb(registers.pc + 1))); }
-void RORzpxf() { ROR(readbp(readb(registers.pc + 1) + registers.x)); }
-void RORabsf() { ROR(readbp(readw(registers.pc + 1))); }
-void RORabsxf() { ROR(readbp(readw(registers.pc + 1) + registers.x)); }
 
-void RTIf() { pullp(&(registers.p)); pullw(&(registers.pc)); }
-void RTSf() { pullw(&(registers.pc)); incPC(1)}
+//65C02 only
+void BITimmf() { registers.p.z = ((registers.ac & readb(operand)) == 0); } //Immediate BIT only touches Z
+void INCaccf() { INC(&(registers.ac)); }
+void DECaccf() { DEC(&(registers.ac)); }
+void JMPCindf() { registers.pc = readw(addrabs(false)); COVER(operand, registers.pc); } //Bug fixed, the pointer may cross a page
+void JMPiabsxf() { word base = addrabs(false); registers.pc = readw(WORDPLUS(base, registers.x)); COVER(operand, registers.pc); }
+void BRAf() { branch(true); }
+void PHXf() { pushb(registers.x); }
+void PLXf() { MOV(pullb(), &(registers.x), true); }
+void PHYf() { pushb(registers.y); }
+void PLYf() { MOV(pullb(), &(registers.y), true); }
+
+//BBRn/BBSn test bit n of a zero page byte and branch. The offset is the second operand byte
+#define BITOPS(n)									\
+    void RMB##n(byte* dest) { *dest &= ~(1 << n); }					\
+    void SMB##n(byte* dest) { *dest |= (1 << n); }					\
+    void BBR##n##f() { if(!(readb(addrzp(true)) & (1 << n))) jumpby((signed char) readb(WORDPLUS(operand, 1))); COVER(operand, registers.pc); } \
+    void BBS##n##f() { if(readb(addrzp(true)) & (1 << n)) jumpby((signed char) readb(WORDPLUS(operand, 1))); COVER(operand, registers.pc); }
+BITOPS(0) BITOPS(1) BITOPS(2) BITOPS(3) BITOPS(4) BITOPS(5) BITOPS(6) BITOPS(7)
+#undef BITOPS
+
+void RTIf() { registers.p = pullp(); registers.pc = pullw(); }
+void RTSf() { word w = pullw(); registers.pc = WORDPLUS(w, 1); COVER(operand, registers.pc); }
+
+void TXSf() { MOV(registers.x, &(registers.sp), false); }
+void TSXf() { MOV(registers.sp, &(registers.x), true); }
+void PHAf() { pushb(registers.ac); }
+void PLAf() { MOV(pullb(), &(registers.ac), true); }
+void PHPf() { pushp(registers.p, true); }
+void PLPf() { registers.p = pullp(); }
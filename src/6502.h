@@ -23,16 +23,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #ifndef CPU_H_INCLUDED
 #define CPU_H_INCLUDED
 
-typedef bit bool;
-typedef byte uint8_t;
-typedef word uint16_t;
+typedef bool bit;
+typedef uint8_t byte;
+typedef uint16_t word;
 
 struct PFLAGS //Processor Status Word (Though technically a byte. Whatever)
 {
@@ -44,7 +43,7 @@ struct PFLAGS //Processor Status Word (Though technically a byte. Whatever)
     bit i; //Interrupt priority level
     bit z; //Zero bit
     bit c; //Carry bit
-}
+};
 
 struct CPUREGS //CPU Registers
 {
@@ -54,66 +53,136 @@ struct CPUREGS //CPU Registers
     struct PFLAGS p; //Processor status flags
     byte sp; //Stack pointer
     word pc; //Program Counter
-}
+};
 
 struct CPUMEM //Memory map. Technically segmented, but you can pretty much do anything at any address
 {
     byte* zero; //0x0000-0x00ff
     byte* stack; //0x0100-0x01ff
     //In Atari 2600, 0x0080-0x00ff is same as 0x0180-0x01ff. For Atari emulators, should be implemented
-    byte** pages = byte*[254]; //Memory pages from 0x0200-0xffff
+    byte* pages[254]; //Memory pages from 0x0200-0xffff
     //0xfffa-0xfffb is address of the Non-Maskable Interrupt routine (NMI)
     //0xfffc-0xfffd is address of the Reset routine (RST)
     //0xfffe-0xffff is address of the Maskable Interrupt Request routine (IRQ)
-}
+};
 
 //Helper macros
-#define LOWBYTE(w) (byte) (w&0xff00)>>8 //Little endian makes my head hurt. Why does it even exist?
-#define HIGHBYTE(w) (byte) w&0xff
+#define LOWBYTE(w) (byte) (((w)&0xff00)>>8) //Little endian makes my head hurt. Why does it even exist?
+#define HIGHBYTE(w) (byte) ((w)&0xff)
 
-#define LOWNIBBLE(b) b&0xf
-#define HIGHNIBBLE(b) (b&0xf0)>>4
+#define LOWNIBBLE(b) ((b)&0xf)
+#define HIGHNIBBLE(b) (((b)&0xf0)>>4)
 
 #define ISBYTE(b) (sizeof(b) == 1)
-#define BtoW(low, high) (low << 8) + high //Turning two bytes into a little endian word
-
-#define PtoB(p, brk) (p.n << 7 + p.v << 6 + 1 << 5 + brk << 4 + p.d << 3 + p.i << 2 + p.z << 1 + p.c) //PFLAGS to byte (For pushing onto the stack)
-#define BtoP(b) (struct PFLAGS) {		        \ //Byte to PFLAGS (For pulling from the stack)
-                .n = b & 0x80,				\
-	        .v = b & 0x40,				\
-	        .d = b & 0x8,				\
-	        .i = b & 0x4,				\
-	        .z = b & 0x2,				\
-		     .c = b & 0x1 }
+#define BtoW(low, high) (word) (((low) << 8) + (high)) //Turning two bytes into a little endian word
+
+#define PtoB(p, brk) (byte) ((p.n << 7) + (p.v << 6) + (1 << 5) + ((brk) << 4) + (p.d << 3) + (p.i << 2) + (p.z << 1) + p.c) //PFLAGS to byte (For pushing onto the stack)
+//Byte to PFLAGS (For pulling from the stack)
+#define BtoP(b) (struct PFLAGS) {		        \
+                .n = (b) & 0x80,			\
+	        .v = (b) & 0x40,			\
+	        .d = (b) & 0x8,				\
+	        .i = (b) & 0x4,				\
+	        .z = (b) & 0x2,				\
+		     .c = (b) & 0x1 }
 
 #define LITTLE(w) BtoW(HIGHBYTE(w), LOWBYTE(w))
 #define BIG(w) LITTLE(w) //Syntactic sugar. Just switching the bytes anyway
 
-#define NEGATIVE(b) b&0x80 //Testing for a signed twos-complement byte
+#define NEGATIVE(b) ((b)&0x80) //Testing for a signed twos-complement byte
 
-#define WORDPLUS(w, i) LITTLE(BIG(w) + i) //For adding to a little endian word.
+#define WORDPLUS(w, i) LITTLE(BIG(w) + (i)) //For adding to a little endian word.
 #define WORDPLUSWORD(w1, w2) WORDPLUS(w1, BIG(w2)) //Operator overloading would have made this so much easier
 
-struct CPUREGS registers;
-struct CPUMEM memorymap;
+/*
+ * Every thread gets its own CPU, so a host can run one per worker thread.
+ * Define CPU_LOCAL as nothing for a plain single-threaded build
+ */
+#ifndef CPU_LOCAL
+#define CPU_LOCAL _Thread_local
+#endif
+
+extern CPU_LOCAL struct CPUREGS registers; //Defined in 6502.c, so other files can include this header
+extern CPU_LOCAL struct CPUMEM memorymap;
+
+extern CPU_LOCAL unsigned long cycles; //Clock cycles executed so far
+extern CPU_LOCAL unsigned long nextevent; //Cycle of the next scheduled interrupt or device event (0 if nothing is scheduled)
+
+//Per-page flags, indexed by HIGHBYTE(address)
+#define PAGE_IO 0x1 //Reads and writes go to ioread()/iowrite() instead of memory
+#define PAGE_STABLE 0x2 //I/O reads have no side effects and only change on device events (Safe to poll in an idle loop)
+#define PAGE_CODE 0x4 //Holds predecoded instructions (See cfg.h), so writes are reported to codewrite()
+#define PAGE_SHARED 0x8 //Another CPU sees this page too (See system.h). Reads and writes are counted in sharedaccesses
+
+extern CPU_LOCAL byte pageflags[256];
+
+extern CPU_LOCAL byte dirty[256]; //Nonzero for pages written since the last checkpoint (See savestate.h)
+
+extern CPU_LOCAL byte (*ioread)(word address); //Memory mapped I/O handlers, set by the host
+extern CPU_LOCAL void (*iowrite)(word address, byte data);
+extern CPU_LOCAL void (*codewrite)(word address, int len); //Called by writepage() before a write to a PAGE_CODE page
+extern CPU_LOCAL void* iodata; //For the handlers, which only get an address: whatever they belong to. Part of the CPU's context
+extern CPU_LOCAL void* codewritedata;
+extern CPU_LOCAL unsigned long sharedaccesses; //Reads and writes to PAGE_SHARED pages
+
+/*
+ * Sparse memory. Pages nobody has written to all share one read-only page of zeros, and get their own
+ * storage from the CPU's arena on the first write. The arena hands out pages in chunks and is freed in one go
+ */
+#define ARENA_CHUNK 8 //Pages per chunk (2 KiB)
+
+struct CHUNK
+{
+    struct CHUNK* next;
+    byte pages[ARENA_CHUNK][0x100];
+};
+
+struct ARENA
+{
+    struct CHUNK* chunks; //Newest first
+    int used; //Pages handed out from the newest chunk
+};
+
+extern CPU_LOCAL struct ARENA* arena; //Where this CPU's pages come from (NULL if memory isn't sparse)
+
+bool sparsemem(struct ARENA* a); //Maps every page to the shared zero page. Start a with all zeros. False if out of memory
+void arenafree(struct ARENA* a); //Frees every page the arena handed out
 
 //Backend function prototypes
 byte* getpage(word address);
+byte* writepage(word address); //Like getpage, but gives the page its own storage first if it doesn't have any
 
 byte readb(word address);
-byte* readbp(word address); //Returns a pointer (For ops like ROL, etc.)
+byte* readbp(word address); //Returns a pointer (For ops like ROL, etc.). Memory only, never an I/O page
+void modify(void (*op)(byte* dest), word address); //Read-modify-write through readbp(), or through the I/O handlers
 word readw(word address);
+word readwp(word address); //Like readw, but wraps around inside the page (Zero page pointers, JMP indirect)
 
 void writeb(word address, byte data);
 
-void writeblock(word start, byte* block, word len); //For loading large chunks of memory
+/*
+ * Block moves, a page at a time with memcpy()/memset(). Only I/O pages go a byte at a time through the handlers;
+ * writes still mark pages dirty and report code writes, and shared pages count every byte
+ */
+void readblock(word start, byte* block, word len);
+void writeblock(word start, const byte* block, word len); //For loading large chunks of memory
+void fillblock(word start, byte value, word len);
+int compareblock(word start, const byte* block, word len); //Like memcmp()
+
+/*
+ * Direct pointers into memory, for as much of [start, start + *len) as is one contiguous run of RAM (No I/O
+ * pages, and each page's storage right after the last). *len is cut down to that, and is 0 (With NULL) if start
+ * is an I/O page. writespan() does the bookkeeping for a write to the whole span before returning it
+ */
+const byte* readspan(word start, word* len);
+byte* writespan(word start, word* len);
 
 void pushb(byte b);
 void pushw(word w);
 void pushp(struct PFLAGS p, bool b); //Push PFLAGS
-void pullb(byte* b);
-void pullw(word* w);
-void pullp(struct PFLAGS* p); //Pull PFLAGS
+byte pullb();
+word pullw();
+struct PFLAGS pullp(); //Pull PFLAGS
 
 void jump(word address);
 void jumpi(word address);
@@ -124,17 +193,67 @@ void reset();
  * 0 - Maskable Interrupt (/irq)
  * 1 - Non-Maskable Interrupt (/nmi)
  * 2 - Break Instruction (BRK)
+ * IRQ and NMI entry take 7 cycles, as on the real chip
  */
 void interrupt(int type);
 
 void next();
 void start();
 
+/*
+ * Edge coverage for fuzzing. Build with -DCOVERAGE and the branch, jump and return handlers count every
+ * (source PC, target PC) pair they take. The front end defines the counters (See fuzz.c)
+ */
+#ifdef COVERAGE
+#define COVERAGE_SIZE 0x10000
+extern byte coverage[COVERAGE_SIZE];
+#define COVER(from, to) coverage[((BIG(from) << 1) ^ BIG(to)) & (COVERAGE_SIZE - 1)]++
+#else
+#define COVER(from, to) (void) (from) //Keeps the handlers' from variables from warning
+#endif
+
+/*
+ * The emulator's own counters. Build with -DSTATS to keep them (perfstats.c needs them), otherwise COUNT()
+ * compiles to nothing and the run loop doesn't pay for them
+ */
+#ifdef STATS
+struct CPUSTATS
+{
+    unsigned long retired; //Instructions executed
+    unsigned long opcodes[256]; //The same, by opcode
+    unsigned long idlecycles; //Cycles skipped over in idle loops
+    unsigned long interrupts; //IRQs, NMIs and BRKs taken
+    unsigned long ioaccesses; //Reads and writes that went to ioread()/iowrite()
+};
+
+extern CPU_LOCAL struct CPUSTATS stats;
+#define COUNT(x) (x)
+#else
+#define COUNT(x)
+#endif
+
+int idleloop(); //Cycles per iteration if PC sits in a side-effect-free spin loop, 0 otherwise
+void idleskip(word pc, unsigned long end); //After code that started at pc: skips the whole idle loop iterations that fit before end
+unsigned long run(unsigned long n); //Runs for n cycles or until nextevent, skipping over idle loops
+
+/*
+ * Cycle-exact bus core (buscore.c). It runs the same opcodes, but makes every bus cycle the real chip does,
+ * dummy reads and RMW double writes included, one access per cycle. I/O handlers see each one with cycles
+ * pointing at that exact cycle. run() and interrupt() switch to it when busexact is set; next() is always the fast core
+ */
+extern CPU_LOCAL bool busexact;
+extern CPU_LOCAL void (*busaccess)(word address, byte data, bool write); //Optional, sees every bus cycle
+
+bool setbusmode(bool exact); //Call after setvariant(). NMOS only, false (And no change) for the 65C02
+void nextbus();
+unsigned long runbus(unsigned long n);
+void businterrupt(int type);
+
 void ADC(byte src, byte* dest);
 void AND(byte src, byte* dest);
 void ASL(byte* dest);
-void BIT(byte b1, byte b2); //b1 == b2
-void CMP(byte b1, byte b2); //b1 <= b2
+void BIT(byte b1, byte b2); //b1 is the accumulator, b2 the memory operand
+void CMP(byte b1, byte b2); //b1 is the register, b2 the memory operand
 void DEC(byte* dest);
 void EOR(byte src, byte* dest);
 void INC(byte* dest);
@@ -144,181 +263,371 @@ void ROL(byte* dest);
 void ROR(byte* dest);
 void SBC(byte src, byte* dest);
 
-void MOV(byte src, byte* dest); //Generic function for moving memory around (Used for T**, LD*, etc.)
+void MOV(byte src, byte* dest, bool flags); //Generic function for moving memory around (Used for T**, LD*, etc.)
+
+//Undocumented NMOS operations
+void SLO(byte* dest); //ASL, then ORA
+void RLA(byte* dest); //ROL, then AND
+void SRE(byte* dest); //LSR, then EOR
+void RRA(byte* dest); //ROR, then ADC
+void DCP(byte* dest); //DEC, then CMP
+void ISC(byte* dest); //INC, then SBC
+void LAX(byte src, byte* dest); //LDA and LDX at once
+void ANC(byte src, byte* dest); //AND, with N copied into C
+void ALR(byte src, byte* dest); //AND, then LSR A
+void ARR(byte src, byte* dest); //AND, then ROR A (With strange C and V)
+void SBX(byte src, byte* dest); //X = (A & X) - src, flags like CMP
+byte SAX(); //A & X, for storing
+
+//65C02 operations
+void ADCC(byte src, byte* dest); //ADC with valid N and Z in decimal mode
+void SBCC(byte src, byte* dest);
+void TSB(byte* dest); //Test and Set Bits
+void TRB(byte* dest); //Test and Reset Bits
+byte STZ(); //Zero, for storing
+
+/*
+ * Every opcode, as X(name, mode, kind, register, code, length, time)
+ * kind picks the generator for the handler name##mode##f:
+ *   ALU - name(operand, &register) (ADC, AND, ...)
+ *   LOAD - register = operand, setting N and Z
+ *   COMPARE - CMP(register, operand)
+ *   TEST - BIT(register, operand)
+ *   MODIFY - name(pointer to operand) (Read-modify-write)
+ *   STORE - operand = register
+ *   IMPLIED - Written by hand
+ * The handlers and the dispatch table are both generated from this list, so there is exactly one of each.
+ */
+#define OPCODES(X)					\
+    X(ADC, imm, ALU, ac, 0x69, 2, 2)			\
+    X(ADC, zp, ALU, ac, 0x65, 2, 3)			\
+    X(ADC, zpx, ALU, ac, 0x75, 2, 4)			\
+    X(ADC, abs, ALU, ac, 0x6d, 3, 4)			\
+    X(ADC, absx, ALU, ac, 0x7d, 3, 4)			\
+    X(ADC, absy, ALU, ac, 0x79, 3, 4)			\
+    X(ADC, indx, ALU, ac, 0x61, 2, 6)			\
+    X(ADC, indy, ALU, ac, 0x71, 2, 5)			\
+    X(AND, imm, ALU, ac, 0x29, 2, 2)			\
+    X(AND, zp, ALU, ac, 0x25, 2, 3)			\
+    X(AND, zpx, ALU, ac, 0x35, 2, 4)			\
+    X(AND, abs, ALU, ac, 0x2d, 3, 4)			\
+    X(AND, absx, ALU, ac, 0x3d, 3, 4)			\
+    X(AND, absy, ALU, ac, 0x39, 3, 4)			\
+    X(AND, indx, ALU, ac, 0x21, 2, 6)			\
+    X(AND, indy, ALU, ac, 0x31, 2, 5)			\
+    X(ASL, acc, IMPLIED, ac, 0x0a, 1, 2)		\
+    X(ASL, zp, MODIFY, ac, 0x06, 2, 5)			\
+    X(ASL, zpx, MODIFY, ac, 0x16, 2, 6)			\
+    X(ASL, abs, MODIFY, ac, 0x0e, 3, 6)			\
+    X(ASL, absx, MODIFY, ac, 0x1e, 3, 7)		\
+    X(BIT, zp, TEST, ac, 0x24, 2, 3)			\
+    X(BIT, abs, TEST, ac, 0x2c, 3, 4)			\
+    X(BPL, , IMPLIED, ac, 0x10, 2, 2)			\
+    X(BMI, , IMPLIED, ac, 0x30, 2, 2)			\
+    X(BVC, , IMPLIED, ac, 0x50, 2, 2)			\
+    X(BVS, , IMPLIED, ac, 0x70, 2, 2)			\
+    X(BCC, , IMPLIED, ac, 0x90, 2, 2)			\
+    X(BCS, , IMPLIED, ac, 0xb0, 2, 2)			\
+    X(BNE, , IMPLIED, ac, 0xd0, 2, 2)			\
+    X(BEQ, , IMPLIED, ac, 0xf0, 2, 2)			\
+    X(BRK, , IMPLIED, ac, 0x00, 1, 7)			\
+    X(CMP, imm, COMPARE, ac, 0xc9, 2, 2)		\
+    X(CMP, zp, COMPARE, ac, 0xc5, 2, 3)			\
+    X(CMP, zpx, COMPARE, ac, 0xd5, 2, 4)		\
+    X(CMP, abs, COMPARE, ac, 0xcd, 3, 4)		\
+    X(CMP, absx, COMPARE, ac, 0xdd, 3, 4)		\
+    X(CMP, absy, COMPARE, ac, 0xd9, 3, 4)		\
+    X(CMP, indx, COMPARE, ac, 0xc1, 2, 6)		\
+    X(CMP, indy, COMPARE, ac, 0xd1, 2, 5)		\
+    X(CPX, imm, COMPARE, x, 0xe0, 2, 2)			\
+    X(CPX, zp, COMPARE, x, 0xe4, 2, 3)			\
+    X(CPX, abs, COMPARE, x, 0xec, 3, 4)			\
+    X(CPY, imm, COMPARE, y, 0xc0, 2, 2)			\
+    X(CPY, zp, COMPARE, y, 0xc4, 2, 3)			\
+    X(CPY, abs, COMPARE, y, 0xcc, 3, 4)			\
+    X(DEC, zp, MODIFY, ac, 0xc6, 2, 5)			\
+    X(DEC, zpx, MODIFY, ac, 0xd6, 2, 6)			\
+    X(DEC, abs, MODIFY, ac, 0xce, 3, 6)			\
+    X(DEC, absx, MODIFY, ac, 0xde, 3, 7)		\
+    X(EOR, imm, ALU, ac, 0x49, 2, 2)			\
+    X(EOR, zp, ALU, ac, 0x45, 2, 3)			\
+    X(EOR, zpx, ALU, ac, 0x55, 2, 4)			\
+    X(EOR, abs, ALU, ac, 0x4d, 3, 4)			\
+    X(EOR, absx, ALU, ac, 0x5d, 3, 4)			\
+    X(EOR, absy, ALU, ac, 0x59, 3, 4)			\
+    X(EOR, indx, ALU, ac, 0x41, 2, 6)			\
+    X(EOR, indy, ALU, ac, 0x51, 2, 5)			\
+    X(CLC, , IMPLIED, ac, 0x18, 1, 2)			\
+    X(SEC, , IMPLIED, ac, 0x38, 1, 2)			\
+    X(CLI, , IMPLIED, ac, 0x58, 1, 2)			\
+    X(SEI, , IMPLIED, ac, 0x78, 1, 2)			\
+    X(CLV, , IMPLIED, ac, 0xb8, 1, 2)			\
+    X(CLD, , IMPLIED, ac, 0xd8, 1, 2)			\
+    X(SED, , IMPLIED, ac, 0xf8, 1, 2)			\
+    X(INC, zp, MODIFY, ac, 0xe6, 2, 5)			\
+    X(INC, zpx, MODIFY, ac, 0xf6, 2, 6)			\
+    X(INC, abs, MODIFY, ac, 0xee, 3, 6)			\
+    X(INC, absx, MODIFY, ac, 0xfe, 3, 7)		\
+    X(JMP, abs, IMPLIED, ac, 0x4c, 3, 3)		\
+    X(JMP, ind, IMPLIED, ac, 0x6c, 3, 5)		\
+    X(JSR, , IMPLIED, ac, 0x20, 3, 6)			\
+    X(LDA, imm, LOAD, ac, 0xa9, 2, 2)			\
+    X(LDA, zp, LOAD, ac, 0xa5, 2, 3)			\
+    X(LDA, zpx, LOAD, ac, 0xb5, 2, 4)			\
+    X(LDA, abs, LOAD, ac, 0xad, 3, 4)			\
+    X(LDA, absx, LOAD, ac, 0xbd, 3, 4)			\
+    X(LDA, absy, LOAD, ac, 0xb9, 3, 4)			\
+    X(LDA, indx, LOAD, ac, 0xa1, 2, 6)			\
+    X(LDA, indy, LOAD, ac, 0xb1, 2, 5)			\
+    X(LDX, imm, LOAD, x, 0xa2, 2, 2)			\
+    X(LDX, zp, LOAD, x, 0xa6, 2, 3)			\
+    X(LDX, zpy, LOAD, x, 0xb6, 2, 4)			\
+    X(LDX, abs, LOAD, x, 0xae, 3, 4)			\
+    X(LDX, absy, LOAD, x, 0xbe, 3, 4)			\
+    X(LDY, imm, LOAD, y, 0xa0, 2, 2)			\
+    X(LDY, zp, LOAD, y, 0xa4, 2, 3)			\
+    X(LDY, zpx, LOAD, y, 0xb4, 2, 4)			\
+    X(LDY, abs, LOAD, y, 0xac, 3, 4)			\
+    X(LDY, absx, LOAD, y, 0xbc, 3, 4)			\
+    X(LSR, acc, IMPLIED, ac, 0x4a, 1, 2)		\
+    X(LSR, zp, MODIFY, ac, 0x46, 2, 5)			\
+    X(LSR, zpx, MODIFY, ac, 0x56, 2, 6)			\
+    X(LSR, abs, MODIFY, ac, 0x4e, 3, 6)			\
+    X(LSR, absx, MODIFY, ac, 0x5e, 3, 7)		\
+    X(NOP, , IMPLIED, ac, 0xea, 1, 2)			\
+    X(ORA, imm, ALU, ac, 0x09, 2, 2)			\
+    X(ORA, zp, ALU, ac, 0x05, 2, 3)			\
+    X(ORA, zpx, ALU, ac, 0x15, 2, 4)			\
+    X(ORA, abs, ALU, ac, 0x0d, 3, 4)			\
+    X(ORA, absx, ALU, ac, 0x1d, 3, 4)			\
+    X(ORA, absy, ALU, ac, 0x19, 3, 4)			\
+    X(ORA, indx, ALU, ac, 0x01, 2, 6)			\
+    X(ORA, indy, ALU, ac, 0x11, 2, 5)			\
+    X(TAX, , IMPLIED, ac, 0xaa, 1, 2)			\
+    X(TXA, , IMPLIED, ac, 0x8a, 1, 2)			\
+    X(DEX, , IMPLIED, ac, 0xca, 1, 2)			\
+    X(INX, , IMPLIED, ac, 0xe8, 1, 2)			\
+    X(TAY, , IMPLIED, ac, 0xa8, 1, 2)			\
+    X(TYA, , IMPLIED, ac, 0x98, 1, 2)			\
+    X(DEY, , IMPLIED, ac, 0x88, 1, 2)			\
+    X(INY, , IMPLIED, ac, 0xc8, 1, 2)			\
+    X(ROL, acc, IMPLIED, ac, 0x2a, 1, 2)		\
+    X(ROL, zp, MODIFY, ac, 0x26, 2, 5)			\
+    X(ROL, zpx, MODIFY, ac, 0x36, 2, 6)			\
+    X(ROL, abs, MODIFY, ac, 0x2e, 3, 6)			\
+    X(ROL, absx, MODIFY, ac, 0x3e, 3, 7)		\
+    X(ROR, acc, IMPLIED, ac, 0x6a, 1, 2)		\
+    X(ROR, zp, MODIFY, ac, 0x66, 2, 5)			\
+    X(ROR, zpx, MODIFY, ac, 0x76, 2, 6)			\
+    X(ROR, abs, MODIFY, ac, 0x6e, 3, 6)			\
+    X(ROR, absx, MODIFY, ac, 0x7e, 3, 7)		\
+    X(RTI, , IMPLIED, ac, 0x40, 1, 6)			\
+    X(RTS, , IMPLIED, ac, 0x60, 1, 6)			\
+    X(SBC, imm, ALU, ac, 0xe9, 2, 2)			\
+    X(SBC, zp, ALU, ac, 0xe5, 2, 3)			\
+    X(SBC, zpx, ALU, ac, 0xf5, 2, 4)			\
+    X(SBC, abs, ALU, ac, 0xed, 3, 4)			\
+    X(SBC, absx, ALU, ac, 0xfd, 3, 4)			\
+    X(SBC, absy, ALU, ac, 0xf9, 3, 4)			\
+    X(SBC, indx, ALU, ac, 0xe1, 2, 6)			\
+    X(SBC, indy, ALU, ac, 0xf1, 2, 5)			\
+    X(STA, zp, STORE, ac, 0x85, 2, 3)			\
+    X(STA, zpx, STORE, ac, 0x95, 2, 4)			\
+    X(STA, abs, STORE, ac, 0x8d, 3, 4)			\
+    X(STA, absx, STORE, ac, 0x9d, 3, 5)			\
+    X(STA, absy, STORE, ac, 0x99, 3, 5)			\
+    X(STA, indx, STORE, ac, 0x81, 2, 6)			\
+    X(STA, indy, STORE, ac, 0x91, 2, 6)			\
+    X(TXS, , IMPLIED, ac, 0x9a, 1, 2)			\
+    X(TSX, , IMPLIED, ac, 0xba, 1, 2)			\
+    X(PHA, , IMPLIED, ac, 0x48, 1, 3)			\
+    X(PLA, , IMPLIED, ac, 0x68, 1, 4)			\
+    X(PHP, , IMPLIED, ac, 0x08, 1, 3)			\
+    X(PLP, , IMPLIED, ac, 0x28, 1, 4)			\
+    X(STX, zp, STORE, x, 0x86, 2, 3)			\
+    X(STX, zpy, STORE, x, 0x96, 2, 4)			\
+    X(STX, abs, STORE, x, 0x8e, 3, 4)			\
+    X(STY, zp, STORE, y, 0x84, 2, 3)			\
+    X(STY, zpx, STORE, y, 0x94, 2, 4)			\
+    X(STY, abs, STORE, y, 0x8c, 3, 4)
+
+/*
+ * Undocumented NMOS opcodes. Only the ones that behave the same on every chip are here (No XAA, AHX, JAM, etc.)
+ * WRITE stores name(), SKIP reads the operand and throws it away.
+ * Several opcodes can share one handler; only the first of them generates it, the rest are IMPLIED.
+ */
+#define ILLEGAL_OPCODES(X)				\
+    X(SLO, zp, MODIFY, ac, 0x07, 2, 5)			\
+    X(SLO, zpx, MODIFY, ac, 0x17, 2, 6)			\
+    X(SLO, abs, MODIFY, ac, 0x0f, 3, 6)			\
+    X(SLO, absx, MODIFY, ac, 0x1f, 3, 7)		\
+    X(SLO, absy, MODIFY, ac, 0x1b, 3, 7)		\
+    X(SLO, indx, MODIFY, ac, 0x03, 2, 8)		\
+    X(SLO, indy, MODIFY, ac, 0x13, 2, 8)		\
+    X(RLA, zp, MODIFY, ac, 0x27, 2, 5)			\
+    X(RLA, zpx, MODIFY, ac, 0x37, 2, 6)			\
+    X(RLA, abs, MODIFY, ac, 0x2f, 3, 6)			\
+    X(RLA, absx, MODIFY, ac, 0x3f, 3, 7)		\
+    X(RLA, absy, MODIFY, ac, 0x3b, 3, 7)		\
+    X(RLA, indx, MODIFY, ac, 0x23, 2, 8)		\
+    X(RLA, indy, MODIFY, ac, 0x33, 2, 8)		\
+    X(SRE, zp, MODIFY, ac, 0x47, 2, 5)			\
+    X(SRE, zpx, MODIFY, ac, 0x57, 2, 6)			\
+    X(SRE, abs, MODIFY, ac, 0x4f, 3, 6)			\
+    X(SRE, absx, MODIFY, ac, 0x5f, 3, 7)		\
+    X(SRE, absy, MODIFY, ac, 0x5b, 3, 7)		\
+    X(SRE, indx, MODIFY, ac, 0x43, 2, 8)		\
+    X(SRE, indy, MODIFY, ac, 0x53, 2, 8)		\
+    X(RRA, zp, MODIFY, ac, 0x67, 2, 5)			\
+    X(RRA, zpx, MODIFY, ac, 0x77, 2, 6)			\
+    X(RRA, abs, MODIFY, ac, 0x6f, 3, 6)			\
+    X(RRA, absx, MODIFY, ac, 0x7f, 3, 7)		\
+    X(RRA, absy, MODIFY, ac, 0x7b, 3, 7)		\
+    X(RRA, indx, MODIFY, ac, 0x63, 2, 8)		\
+    X(RRA, indy, MODIFY, ac, 0x73, 2, 8)		\
+    X(DCP, zp, MODIFY, ac, 0xc7, 2, 5)			\
+    X(DCP, zpx, MODIFY, ac, 0xd7, 2, 6)			\
+    X(DCP, abs, MODIFY, ac, 0xcf, 3, 6)			\
+    X(DCP, absx, MODIFY, ac, 0xdf, 3, 7)		\
+    X(DCP, absy, MODIFY, ac, 0xdb, 3, 7)		\
+    X(DCP, indx, MODIFY, ac, 0xc3, 2, 8)		\
+    X(DCP, indy, MODIFY, ac, 0xd3, 2, 8)		\
+    X(ISC, zp, MODIFY, ac, 0xe7, 2, 5)			\
+    X(ISC, zpx, MODIFY, ac, 0xf7, 2, 6)			\
+    X(ISC, abs, MODIFY, ac, 0xef, 3, 6)			\
+    X(ISC, absx, MODIFY, ac, 0xff, 3, 7)		\
+    X(ISC, absy, MODIFY, ac, 0xfb, 3, 7)		\
+    X(ISC, indx, MODIFY, ac, 0xe3, 2, 8)		\
+    X(ISC, indy, MODIFY, ac, 0xf3, 2, 8)		\
+    X(LAX, zp, ALU, ac, 0xa7, 2, 3)			\
+    X(LAX, zpy, ALU, ac, 0xb7, 2, 4)			\
+    X(LAX, abs, ALU, ac, 0xaf, 3, 4)			\
+    X(LAX, absy, ALU, ac, 0xbf, 3, 4)			\
+    X(LAX, indx, ALU, ac, 0xa3, 2, 6)			\
+    X(LAX, indy, ALU, ac, 0xb3, 2, 5)			\
+    X(SAX, zp, WRITE, ac, 0x87, 2, 3)			\
+    X(SAX, zpy, WRITE, ac, 0x97, 2, 4)			\
+    X(SAX, abs, WRITE, ac, 0x8f, 3, 4)			\
+    X(SAX, indx, WRITE, ac, 0x83, 2, 6)			\
+    X(ANC, imm, ALU, ac, 0x0b, 2, 2)			\
+    X(ANC, imm, IMPLIED, ac, 0x2b, 2, 2)		\
+    X(ALR, imm, ALU, ac, 0x4b, 2, 2)			\
+    X(ARR, imm, ALU, ac, 0x6b, 2, 2)			\
+    X(SBX, imm, ALU, x, 0xcb, 2, 2)			\
+    X(SBC, imm, IMPLIED, ac, 0xeb, 2, 2)		\
+    X(NOP, , IMPLIED, ac, 0x1a, 1, 2)			\
+    X(NOP, , IMPLIED, ac, 0x3a, 1, 2)			\
+    X(NOP, , IMPLIED, ac, 0x5a, 1, 2)			\
+    X(NOP, , IMPLIED, ac, 0x7a, 1, 2)			\
+    X(NOP, , IMPLIED, ac, 0xda, 1, 2)			\
+    X(NOP, , IMPLIED, ac, 0xfa, 1, 2)			\
+    X(NOP, imm, SKIP, ac, 0x80, 2, 2)			\
+    X(NOP, imm, IMPLIED, ac, 0x82, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0x89, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0xc2, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0xe2, 2, 2)		\
+    X(NOP, zp, SKIP, ac, 0x04, 2, 3)			\
+    X(NOP, zp, IMPLIED, ac, 0x44, 2, 3)			\
+    X(NOP, zp, IMPLIED, ac, 0x64, 2, 3)			\
+    X(NOP, zpx, SKIP, ac, 0x14, 2, 4)			\
+    X(NOP, zpx, IMPLIED, ac, 0x34, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0x54, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0x74, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0xd4, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0xf4, 2, 4)		\
+    X(NOP, abs, SKIP, ac, 0x0c, 3, 4)			\
+    X(NOP, absx, SKIP, ac, 0x1c, 3, 4)			\
+    X(NOP, absx, IMPLIED, ac, 0x3c, 3, 4)		\
+    X(NOP, absx, IMPLIED, ac, 0x5c, 3, 4)		\
+    X(NOP, absx, IMPLIED, ac, 0x7c, 3, 4)		\
+    X(NOP, absx, IMPLIED, ac, 0xdc, 3, 4)		\
+    X(NOP, absx, IMPLIED, ac, 0xfc, 3, 4)
+
+//65C02 bit instructions, for bit n: RMBn/SMBn zp and BBRn/BBSn zp, relative
+#define BITOPCODES(X, n)				\
+    X(RMB##n, zp, MODIFY, ac, 0x07 + 0x10 * n, 2, 5)	\
+    X(SMB##n, zp, MODIFY, ac, 0x87 + 0x10 * n, 2, 5)	\
+    X(BBR##n, , IMPLIED, ac, 0x0f + 0x10 * n, 3, 5)	\
+    X(BBS##n, , IMPLIED, ac, 0x8f + 0x10 * n, 3, 5)
+
+/*
+ * 65C02 additions. These are laid over OPCODES, so the entries for opcodes the CMOS chip changed
+ * (ADC/SBC in decimal mode, JMP indirect) replace the NMOS ones. izp is the new (zp) mode
+ * The undefined opcodes that take operands reuse the NOP handlers ILLEGAL_OPCODES generates
+ */
+#define CMOS_OPCODES(X)					\
+    X(ADCC, imm, ALU, ac, 0x69, 2, 2)			\
+    X(ADCC, zp, ALU, ac, 0x65, 2, 3)			\
+    X(ADCC, zpx, ALU, ac, 0x75, 2, 4)			\
+    X(ADCC, abs, ALU, ac, 0x6d, 3, 4)			\
+    X(ADCC, absx, ALU, ac, 0x7d, 3, 4)			\
+    X(ADCC, absy, ALU, ac, 0x79, 3, 4)			\
+    X(ADCC, indx, ALU, ac, 0x61, 2, 6)			\
+    X(ADCC, indy, ALU, ac, 0x71, 2, 5)			\
+    X(ADCC, izp, ALU, ac, 0x72, 2, 5)			\
+    X(SBCC, imm, ALU, ac, 0xe9, 2, 2)			\
+    X(SBCC, zp, ALU, ac, 0xe5, 2, 3)			\
+    X(SBCC, zpx, ALU, ac, 0xf5, 2, 4)			\
+    X(SBCC, abs, ALU, ac, 0xed, 3, 4)			\
+    X(SBCC, absx, ALU, ac, 0xfd, 3, 4)			\
+    X(SBCC, absy, ALU, ac, 0xf9, 3, 4)			\
+    X(SBCC, indx, ALU, ac, 0xe1, 2, 6)			\
+    X(SBCC, indy, ALU, ac, 0xf1, 2, 5)			\
+    X(SBCC, izp, ALU, ac, 0xf2, 2, 5)			\
+    X(ORA, izp, ALU, ac, 0x12, 2, 5)			\
+    X(AND, izp, ALU, ac, 0x32, 2, 5)			\
+    X(EOR, izp, ALU, ac, 0x52, 2, 5)			\
+    X(STA, izp, STORE, ac, 0x92, 2, 5)			\
+    X(LDA, izp, LOAD, ac, 0xb2, 2, 5)			\
+    X(CMP, izp, COMPARE, ac, 0xd2, 2, 5)		\
+    X(BIT, imm, IMPLIED, ac, 0x89, 2, 2)		\
+    X(BIT, zpx, TEST, ac, 0x34, 2, 4)			\
+    X(BIT, absx, TEST, ac, 0x3c, 3, 4)			\
+    X(INC, acc, IMPLIED, ac, 0x1a, 1, 2)		\
+    X(DEC, acc, IMPLIED, ac, 0x3a, 1, 2)		\
+    X(JMPC, ind, IMPLIED, ac, 0x6c, 3, 6)		\
+    X(JMP, iabsx, IMPLIED, ac, 0x7c, 3, 6)		\
+    X(BRA, , IMPLIED, ac, 0x80, 2, 2)			\
+    X(PHX, , IMPLIED, ac, 0xda, 1, 3)			\
+    X(PLX, , IMPLIED, ac, 0xfa, 1, 4)			\
+    X(PHY, , IMPLIED, ac, 0x5a, 1, 3)			\
+    X(PLY, , IMPLIED, ac, 0x7a, 1, 4)			\
+    X(STZ, zp, WRITE, ac, 0x64, 2, 3)			\
+    X(STZ, zpx, WRITE, ac, 0x74, 2, 4)			\
+    X(STZ, abs, WRITE, ac, 0x9c, 3, 4)			\
+    X(STZ, absx, WRITE, ac, 0x9e, 3, 5)			\
+    X(TSB, zp, MODIFY, ac, 0x04, 2, 5)			\
+    X(TSB, abs, MODIFY, ac, 0x0c, 3, 6)			\
+    X(TRB, zp, MODIFY, ac, 0x14, 2, 5)			\
+    X(TRB, abs, MODIFY, ac, 0x1c, 3, 6)			\
+    X(NOP, imm, IMPLIED, ac, 0x02, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0x22, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0x42, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0x62, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0x82, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0xc2, 2, 2)		\
+    X(NOP, imm, IMPLIED, ac, 0xe2, 2, 2)		\
+    X(NOP, zp, IMPLIED, ac, 0x44, 2, 3)			\
+    X(NOP, zpx, IMPLIED, ac, 0x54, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0xd4, 2, 4)		\
+    X(NOP, zpx, IMPLIED, ac, 0xf4, 2, 4)		\
+    X(NOP, abs, IMPLIED, ac, 0x5c, 3, 8)		\
+    X(NOP, abs, IMPLIED, ac, 0xdc, 3, 4)		\
+    X(NOP, abs, IMPLIED, ac, 0xfc, 3, 4)		\
+    BITOPCODES(X, 0) BITOPCODES(X, 1) BITOPCODES(X, 2) BITOPCODES(X, 3) \
+    BITOPCODES(X, 4) BITOPCODES(X, 5) BITOPCODES(X, 6) BITOPCODES(X, 7)
+
+//Operations behind the bit instructions
+#define BITPROTO(n) void RMB##n(byte* dest); void SMB##n(byte* dest);
+BITPROTO(0) BITPROTO(1) BITPROTO(2) BITPROTO(3) BITPROTO(4) BITPROTO(5) BITPROTO(6) BITPROTO(7)
+#undef BITPROTO
 
 //Opcode function prototypes
-void ADCimmf();
-void ADCzpf();
-void ADCzpxf();
-void ADCabsf();
-void ADCabsxf();
-void ADCabsyf();
-void ADCindxf();
-void ADCindyf();
-
-void ANDimmf();
-void ANDzpf();
-void ANDzpxf();
-void ANDabsf();
-void ANDabsxf();
-void ANDabsyf();
-void ANDindxf();
-void ANDindyf();
-
-void ASLaccf();
-void ASLzpf();
-void ASLzpxf();
-void ASLabsf();
-void ASLabsxf();
-
-void BITzpf();
-void BITabsf(); 
-
-void BPLf();
-void BMIf();
-void BVCf();
-void BVSf();
-void BCCf();
-void BCSf();
-void BNEf();
-void BEQf();
-
-void BRKf();
-
-void CMPimmf();
-void CMPzpf();
-void CMPzpxf();
-void CMPabsf();
-void CMPabsxf();
-void CMPabsyf();
-void CMPindxf();
-void CMPindyf();
-
-void CPXimmf();
-void CPXzpf();
-void CPXabsf();
-
-void CPYimmf();
-void CPYzpf();
-void CPYabsf();
-
-void DECzpf();
-void DECzpxf();
-void DECabsf();
-void DECabsxf();
-
-void EORimmf();
-void EORzpf();
-void EORzpxf();
-void EORabsf();
-void EORabsxf();
-void EORabsyf();
-void EORindxf();
-void EORindyf();
-
-void CLCf();
-void SECf();
-void CLIf();
-void SEIf();
-void CLVf();
-void CLDf();
-void SEDf();
-
-void INCzpf();
-void INCzpxf();
-void INCabsf();
-void INCabsxf();
-
-void JMPabsf();
-void JMPindf();
-
-void JSRf();
-
-void LDAimmf();
-void LDAzpf();
-void LDAzpxf();
-void LDAabsf();
-void LDAabsxf();
-void LDAabsyf();
-void LDAindxf();
-void LDAindyf();
-
-void LDXimmf();
-void LDXzpf();
-void LDXzpyf();
-void LDXabsf();
-void LDXabsyf();
-
-void LDYimmf();
-void LDYzpf();
-void LDYzpxf();
-void LDYabsf();
-void LDYabsxf();
-
-void LSRaccf();
-void LSRzpf();
-void LSRzpxf();
-void LSRabsf();
-void LSRabsxf();
-
-void NOPf();
-
-void ORAimmf();
-void ORAzpf();
-void ORAzpxf();
-void ORAabsf();
-void ORAabsxf();
-void ORAabsyf();
-void ORAindxf();
-void ORAindyf();
-
-void TAXf();
-void TXAf();
-void DEXf();
-void INXf();
-void TAYf();
-void TYAf();
-void DEYf();
-void INYf();
-
-void ROLaccf();
-void ROLzpf();
-void ROLzpxf();
-void ROLabsf();
-void ROLabsxf();
-
-void RORaccf();
-void RORzpf();
-void RORzpxf();
-void RORabsf();
-void RORabsxf();
-
-void RTIf();
-
-void RTSf();
-
-void STAzpf();
-void STAzpxf();
-void STAabsf();
-void STAabsxf();
-void STAabsyf();
-void STAindxf();
-void STAindyf();
-
-void TXSf();
-void TSXf();
-void PHAf();
-void PLAf();
-void PHPf();
-void PLPf();
-
-void STXzpf();
-void STXzpyf();
-void STXabsf();
-
-void STXzpf();
-void STXzpxf();
-void STXabsf();
+#define PROTO(name, mode, kind, reg, c, l, t) void name##mode##f();
+OPCODES(PROTO)
+ILLEGAL_OPCODES(PROTO)
+CMOS_OPCODES(PROTO)
+#undef PROTO
 
 typedef struct //Typedef because it looks nicer
 {
@@ -329,222 +638,61 @@ typedef struct //Typedef because it looks nicer
     int time;
 } opcode;
 
-struct INSTRUCTIONS //Lots of stuff
+extern CPU_LOCAL opcode* optable; //Dispatch table of the selected variant, indexed by opcode byte
+
+/*
+ * Runs count instructions already decoded from the code at PC (See cfg.c), the way next() would one at a time.
+ * Stops early at end or nextevent, like run(), or once *stop is set. Returns how many ran
+ */
+int nextops(opcode* const* ops, int count, unsigned long end, const bool* stop);
+
+//CPU variants
+#define CPU_NMOS 0 //Documented NMOS opcodes only
+#define CPU_NMOSX 1 //NMOS with the undocumented opcodes
+#define CPU_65C02 2 //CMOS 65C02, with the Rockwell/WDC bit instructions
+
+#define CORE_VERSION 1 //Bump when the dispatch tables change, so anything decoded from them and kept on disk is rebuilt
+
+struct INSTRUCTIONS_EX //Dispatch tables for each variant, all built at compile time
+{
+    opcode* nmos;
+    opcode* illegal;
+    opcode* cmos;
+};
+
+extern struct INSTRUCTIONS_EX instructions;
+extern CPU_LOCAL int variant; //One of CPU_*
+
+void setvariant(int v); //Picks the instruction set. Call it before reset(), when setting up the CPU
+
+/*
+ * Everything that makes up one CPU, for hosts with more than one (See system.h). Loading a context
+ * replaces this thread's CPU with it; save it again before loading another
+ */
+struct CPUCONTEXT
 {
-    //ADd with Carry
-    opcode ADCimm = { .code = 0x69, .op = &(ADCimmf), .len = 2, .time = 2 };
-    opcode ADCzp = { .code = 0x65, .op = &(ADCzpf), .len = 2, .time = 3 };
-    opcode ADCzpx = { .code = 0x75, .op = &(ADCzpxf), .len = 2, .time = 4 };
-    opcode ADCabs = { .code = 0x6d, .op = &(ADCabsf), .len = 3, .time = 4 };
-    opcode ADCabsx = { .code = 0x7d, .op = &(ADCabsxf), .len = 3, .time = 4 };
-    opcode ADCabsy = { .code = 0x79, .op = &(ADCabsyf), .len = 3, .time = 4 };
-    opcode ADCindx = { .code = 0x61, .op = &(ADCindxf), .len = 2, .time = 6 };
-    opcode ADCindy = { .code = 0x71, .op = &(ADCindyf), .len = 2, .time = 5 };
-
-    //bitwise AND
-    opcode ADDimm = { .code = 0x29, .op = &(ADDimmf), .len = 2, .time = 2 };
-    opcode ADDzp = { .code = 0x25, .op = &(ADDzpf), .len = 2, .time = 3 };
-    opcode ADDzpx = { .code = 0x35, .op = &(ADDzpxf), .len = 2, .time = 4 };
-    opcode ADDabs = { .code = 0x2d, .op = &(ADDabsf), .len = 3, .time = 4 };
-    opcode ADDabsx = { .code = 0x3d, .op = &(ADDabsxf), .len = 3, .time = 4 };
-    opcode ADDabsy = { .code = 0x39, .op = &(ADDabsyf), .len = 3, .time = 4 };
-    opcode ADDindx = { .code = 0x21, .op = &(ADDindxf), .len = 2, .time = 6 };
-    opcode ADDindy = { .code = 0x31, .op = &(ADDindyf), .len = 2, .time = 5 };
-
-    //Arithmetic Shift Left
-    opcode ASLacc = { .code = 0x0a, .op = &(ASLaccf), .len = 1, .time = 2 };
-    opcode ASLzp = { .code = 0x06, .op = &(ASLzpf), .len = 2, .time = 5 };
-    opcode ASLzpx = { .code = 0x16, .op = &(ASLzpxf), .len = 2, .time = 6 };
-    opcode ASLabs = { .code = 0x0e, .op = &(ASLabsf), .len = 3, .time = 6 };
-    opcode ASLabsx = { .code = 0x1e, .op = &(ASLabsxf), .len = 3, .time = 7 };
-
-    //test BITs
-    opcode BITzp = { .code = 0x24, .op = &(BITzpf), .len  = 2, .time = 3 };
-    opcode BITabs = { .code = 0x2c, .op = &(BITabsf), .len = 3, .time = 4 };
-
-    //Branch
-    opcode BPL = { .code = 0x10, .op = &(BPLf), .len = 2, .time = 2 }; //on PLus
-    opcode BMI = { .code = 0x30, .op = &(BMIf), .len = 2, .time = 2 }; //on MInus
-    opcode BVC = { .code = 0x50, .op = &(BVCf), .len = 2, .time = 2 }; //on oVerflow Clear
-    opcode BVS = { .code = 0x70, .op = &(BVSf), .len = 2, .time = 2 }; //on oVerflow Set
-    opcode BCC = { .code = 0x90, .op = &(BCCf), .len = 2, .time = 2 }; //on Carry Clear
-    opcode BCS = { .code = 0xb0, .op = &(BCSf), .len = 2, .time = 2 }; //on Carry Set
-    opcode BNE = { .code = 0xd0, .op = &(BNEf), .len = 2, .time = 2 }; //on Not Equal
-    opcode BEQ = { .code = 0xf0, .op = &(BEQf), .len = 2, .time = 2 }; //on EQual
-
-    //BReaK
-    opcode BRK = { .code = 0x00, .op = &(BRKf), .len = 1, .time = 7 };
-
-    //CoMPare with accumulator
-    opcode CMPimm = { .code = 0xc9, .op = &(CMPimmf), .len = 2, .time = 2 };
-    opcode CMPzp = { .code = 0xc5, .op = &(CMPzpf), .len = 2, .time = 3 };
-    opcode CMPzpx = { .code = 0xd5, .op = &(CMPzpxf), .len = 2, .time = 4 };
-    opcode CMPabs = { .code = 0xcd, .op = &(CMPabsf), .len = 3, .time = 4 };
-    opcode CMPabsx = { .code = 0xdd, .op = &(CMPabsxf), .len = 3, .time = 4 };
-    opcode CMPabsy = { .code = 0xd9, .op = &(CMPabsyf), .len = 3, .time = 4 };
-    opcode CMPindx = { .code = 0xc1, .op = &(CMPindxf), .len = 2, .time = 6 };
-    opcode CMPindy = { .code = 0xd1, .op = &(CMPindyf), .len = 2, .time = 5 };
-
-    //ComPare with X register
-    opcode CPXimm = { .code = 0xe0, .op = &(CPXimmf), .len = 2, .time = 2 };
-    opcode CPXzp = { .code = 0xe4, .op = &(CPXzpf), .len = 2, .time = 3 };
-    opcode CPXabs = { .code = 0xec, .op = &(CPXabsf), .len = 2, .time = 4 };
-
-    //ComPare with Y register
-    opcode CPYimm = { .code = 0xc0, .op = &(CPYimmf), .len = 2, .time = 2 };
-    opcode CPYzp = { .code = 0xc4, .op = &(CPYzpf), .len = 2, .time = 3 };
-    opcode CPYabs = { .code = 0xcc, .op = &(CPYabsf), .len  = 3, .time = 4 };
-
-    //DECrement memory
-    opcode DECzp = { .code = 0xc6, .op = &(DECzpf), .len = 2, .time = 5 };
-    opcode DECzpx = { .code = 0xd6, .op = &(DECzpxf), .len = 2, .time = 6 };
-    opcode DECabs = { .code = 0xce, .op = &(DECabsf), .len = 3, .time = 6 };
-    opcode DECabsx = { .code = 0xde, .op = &(DECabsxf), .len = 3, .time = 7 };
-
-    //bitwise Exclusive OR
-    opcode EORimm = { .code = 0x49, .op = &(EORimmf), .len = 2, .time = 2 };
-    opcode EORzp = { .code = 0x45, .op = &(EORzpf), .len = 2, .time = 3 };
-    opcode EORzpx = { .code = 0x55, .op = &(EORzpxf), .len = 2, .time = 4 };
-    opcode EORabs = { .code = 0x4d, .op = &(EORabsf), .len = 3, .time = 4 };
-    opcode EORabsx = { .code = 0x5d, .op = &(EORabsxf), .len = 3, .time = 4 };
-    opcode EORabsy = { .code = 0x59, .op = &(EORabsyf), .len = 3, .time = 4 };
-    opcode EORindx = { .code = 0x41, .op = &(EORindxf), .len = 2, .time = 6 };
-    opcode EORindy = { .code = 0x51, .op = &(EORindyf), .len = 2, .time = 5 };
-
-    //flag/processor status
-    opcode CLC = { .code = 0x18, .op = &(CLCf), .len = 1, .time = 2 }; //CLear Carry
-    opcode SEC = { .code = 0x38, .op = &(SECf), .len = 1, .time = 2 }; //SEt Carry
-    opcode CLI = { .code = 0x58, .op = &(CLIf), .len = 1, .time = 2 }; //CLear Interrupt
-    opcode SEI = { .code = 0x78, .op = &(SEIf), .len = 1, .time = 2 }; //SEt Interrupt
-    opcode CLV = { .code = 0xb8, .op = &(CLVf), .len = 1, .time = 2 }; //CLear oVerflow
-    opcode CLD = { .code = 0xd8, .op = &(CLDf), .len = 1, .time = 2 }; //CLear Decimal
-    opcode SED = { .code = 0xf8, .op = &(SEDf), .len = 1, .time = 2 }; //SEt Decimal
-
-    //INCrement memory
-    opcode INCzp = { .code = 0xe6, .op = &(INCzpf), .len = 2, .time = 5 };
-    opcode INCzpx = { .code = 0xf6, .op = &(INCzpxf), .len = 2, .time = 6 };
-    opcode INCabs = { .code = 0xee, .op = &(INCabsf), .len = 3, .time = 6 };
-    opcode INCabsx = { .code = 0xfe, .op = &(INCabsxf), .len = 3, .time = 7 };
-
-    //JuMP to location
-    opcode JMPabs = { .code = 0x4c, .op = &(JMPabsf), .len = 3, .time = 3 };
-    opcode JMPind = { .code = 0x6c, .op = &(JMPindf), .len = 3, .time = 5 };
-
-    //Jump to SubRoutine
-    opcode JSR - { .code = 0x20, .op = &(JSRf), .len = 3, .time = 6 };
-
-    //LoaD Accumulator
-    opcode LDAimm = { .code = 0xa9, .op = &(LDAimmf), .len = 2, .time = 2 };
-    opcode LDAzp = { .code = 0xa5, .op = &(LDAzpf), .len = 2, .time = 3 };
-    opcode LDAzpx = { .code = 0xb5, .op = &(LDAzpxf), .len = 2, .time = 4 };
-    opcode LDAabs = { .code = 0xad, .op = &(LDAabsf), .len = 3, .time = 4 };
-    opcode LDAabsx = { .code = 0xbd, .op = &(LDAabsxf), .len = 3, .time = 4 };
-    opcode LDAabsy = { .code = 0xb9, .op = &(LDAabsyf), .len = 3, .time = 4 };
-    opcode LDAindx = { .code = 0xa1, .op = &(LDAindxf), .len = 2, .time = 6 };
-    opcode LDAindy = { .code = 0xb1, .op = &(LDAindyf), .len = 2, .time = 5 };
-
-    //LoaD X register
-    opcode LDXimm = { .code = 0xa2, .op = &(LDXimmf), .len = 2, .time = 2 };
-    opcode LDXzp = { .code = 0xa6, .op = &(LDXzpf), .len = 2, .time = 3 };
-    opcode LDXzpy = { .code = 0xb6, .op = &(LDXzpyf), .len = 2, .time = 4 };
-    opcode LDXabs = { .code = 0xae, .op = &(LDXabsf), .len = 3, .time = 4 };
-    opcode LDXabsy = { .code = 0xbe, .op = &(LDXabsyf), .len = 3, .time = 4 };
-
-    //LoaD Y register
-    opcode LDYimm = { .code = 0xa0, .op = &(LDYimmf), .len = 2, .time = 2 };
-    opcode LDYzp = { .code = 0xa4, .op = &(LDYzpf), .len = 2, .time = 3 };
-    opcode LDYzpx = { .code = 0xb4, .op = &(LDYzpxf), .len = 2, .time = 4 };
-    opcode LDYabs = { .code = 0xac, .op = &(LDYabsf), .len = 3, .time = 4 };
-    opcode LDYabsx = { .code = 0xbc, .op = &(LDYabsxf), .len = 3, .time = 4 };
-
-    //Logical Shift Right
-    opcode LSRacc = { .code = 0x4a, .op = &(LSRaccf), .len = 1, .time = 2 };
-    opcode LSRzp = { .code = 0x46, .op = &(LSRzpf), .len = 2, .time = 5 };
-    opcode LSRzpx = { .code = 0x56, .op = &(LSRzpxf), .len = 2, .time = 6 };
-    opcode LSRabs = { .code = 0x4e, .op = &(LSRabsf), .len = 3, .time = 6 };
-    opcode LSRabsx = { .code = 0x5e, .op = &(LSRabsxf), .len = 3, .time = 7 };
-
-    //No OPeration
-    opcode NOP = { .code = 0xea, .op = &(NOPf), .len = 1, .time = 2 };
-
-    //bitwise OR with Accumulator
-    opcode ORAimm = { .code = 0x09, .op = &(ORAimmf), .len = 2, .time = 2 };
-    opcode ORAzp = { .code = 0x05, .op = &(ORAzpf), .len = 2, .time = 3 };
-    opcode ORAzpx = { .code = 0x15, .op = &(ORAzpxf), .len = 2, .time = 4 };
-    opcode ORAabs = { .code = 0x0d, .op = &(ORAabsf), .len = 3, .time = 4 };
-    opcode ORAabsx = { .code = 0x1d, .op = &(ORAabsxf), .len = 3, .time = 4 };
-    opcode ORAabsy = { .code = 0x19, .op = &(ORAabsyf), .len = 3, .time = 4 };
-    opcode ORAindx = { .code = 0x01, .op = &(ORAindxf), .len = 2, .time = 6 };
-    opcode ORAindy = { .code = 0x11, .op = &(ORAindyf), .len = 2, .time = 5 };
-
-    //register instructions
-    opcode TAX = { .code = 0xaa, .op = &(TAXf), .len = 1, .time = 2 }; //Transfer A to X
-    opcode TXA = { .code = 0x8a, .op = &(TXAf), .len = 1, .time = 2 }; //Transfer X to A
-    opcode DEX = { .code = 0xca, .op = &(DEXf), .len = 1, .time = 2 }; //DEcrement X
-    opcode INX = { .code = 0xe8, .op = &(INXf), .len = 1, .time = 2 }; //INcrement X
-    opcode TAY = { .code = 0xa8, .op = &(TAYf), .len = 1, .time = 2 }; //Transfer A to Y
-    opcode TYA = { .code = 0x98, .op = &(TYAf), .len = 1, .time = 2 }; //Transfer Y to A
-    opcode DEY = { .code = 0x88, .op = &(DEYf), .len = 1, .time = 2 }; //DEcrement Y
-    opcode INY = { .code = 0xc8, .op = &(INYf), .len = 1, .time = 2 }; //INcrement Y
-
-    //ROtate Left
-    opcode ROLacc = { .code = 0x2a, .op = &(ROLaccf), .len = 1, .time = 2 };
-    opcode ROLzp = { .code = 0x26, .op = &(ROLzpf), .len = 2, .time = 5 };
-    opcode ROLzpx = { .code = 0x36, .op = &(ROLzpxf), .len = 2, .time = 6 };
-    opcode ROLabs = { .code = 0x2e, .op = &(ROLabsf), .len = 3, .time = 6 };
-    opcode ROLabsx = { .code = 0x3e, .op = &(ROLabsxf), .len = 3, .time = 7 };
-
-    //ROtate Right
-    opcode RORacc = { .code = 0x6a, .op = &(RORaccf), .len = 1, .time = 2 };
-    opcode RORzp = { .code = 0x66, .op = &(RORzpf), .len = 2, .time = 5 };
-    opcode RORzpx = { .code = 0x76, .op = &(RORzpxf), .len = 2, .time = 6 };
-    opcode RORabs = { .code = 0x6e, .op = &(RORabsf), .len = 3, .time = 6 };
-    opcode RORabsx = { .code = 0x7e, .op = &(RORabsxf), .len = 3, .time = 7 };
-
-    //ReTurn from Interrupt
-    opcode RTI = { .code = 0x40, .op = &(RTIf), .len = 1, .time = 6 };
-
-    //ReTurn from Subroutine
-    opcode RTS = { .code = 0x60, .op = &(RTSf), .len = 1, .time = 6 };
-
-    //SuBtract with Carry
-    opcode SBCimm = { .code = 0xe9, .op = &(SBCimmf), .len = 2, .time = 2 };
-    opcode SBCzp = { .code = 0xe5, .op = &(SBCzpf), .len = 2, .time = 3 };
-    opcode SBCzpx = { .code = 0xf5, .op = &(SBCzpxf), .len = 2, .time = 4 };
-    opcode SBCabs = { .code = 0xed, .op = &(SBCabsf), .len = 3, .time = 4 };
-    opcode SBCabsx = { .code = 0xfd, .op = &(SBCabsxf), .len = 3, .time = 4 };
-    opcode SBCabsy = { .code = 0xf9, .op = &(SBCabsyf), .len = 3, .time = 4 };
-    opcode SBCindx = { .code = 0xe1, .op = &(SBCindxf), .len = 2, .time = 6 };
-    opcode SBCindy = { .code = 0xf1, .op = &(SBCindyf), .len = 2, .time = 5 };
-
-    //STore Accumulator
-    opcode STAzp = { .code = 0x85, .op = &(STAzpf), .len = 2, .time = 3 };
-    opcode STAzpx = { .code = 0x95, .op = &(STAzpxf), .len = 2, .time = 4 };
-    opcode STAabs = { .code = 0x8d, .op = &(STAabsf), .len = 3, .time = 4 };
-    opcode STAabsx = { .code = 0x9d, .op = &(STAabsxf), .len = 3, .time = 5 };
-    opcode STAabsy = { .code = 0x99, .op = &(STAabsyf), .len = 3, .time = 5 };
-    opcode STAindx = { .code = 0x81, .op = &(STAindxf), .len = 2, .time = 6 };
-    opcode STAindy = { .code = 0x91, .op = &(STAindyf), .len = 2, .time = 6 };
-
-    //stack instructions
-    opcode TXS = { .code = 0x9a, .op = &(TXSf), .len = 1, .time = 2 }; //Transfer X to Stack pointer
-    opcode TSX = { .code = 0xba, .op = &(TSXf), .len = 1, .time = 2 }; //Transfer Stack pointer to X
-    opcode PHA = { .code = 0x48, .op = &(PHAf), .len = 1, .time = 3 }; //PusH Accumulator
-    opcode PLA = { .code = 0x68, .op = &(PLAf), .len = 1, .time = 4 }; //PuLl (pop) Accumulator
-    opcode PHP = { .code = 0x08, .op = &(PHPf), .len = 1, .time = 3 }; //PusH Processor status
-    opcode PLP = { .code = 0x28, .op = &(PLPf), .len = 1, .time = 4 }; //PuLl (pop) Processor status
-
-    //STore X register
-    opcode STXzp = { .code = 0x86, .op = &(STXzpf), .len = 2, .time = 3 };
-    opcode STXzpy = { .code = 0x96, .op = &(STXzpyf), .len = 2, .time = 4 };
-    opcode STXabs = { .code = 0x8e, .op = &(STXabsf), .len = 3, .time = 4 };
-
-    //STore Y register
-    opcode STYzp = { .code = 0x84, .op = &(STYzpf), .len = 2, .time = 3 };
-    opcode STYzpy = { .code = 0x94, .op = &(STYzpyf), .len = 2, .time = 4 };
-    opcode STYabs = { .code = 0x8c, .oop = &(STYabsf), .len = 3, .time = 4 };
-}
-
-struct INSTRUCTIONS_EX {} //To be used for extensions (Probably not being used any time soon)
+    struct CPUREGS registers;
+    struct CPUMEM memorymap;
+    unsigned long cycles;
+    unsigned long nextevent;
+    byte pageflags[256];
+    byte dirty[256];
+    byte (*ioread)(word address);
+    void (*iowrite)(word address, byte data);
+    void (*codewrite)(word address, int len);
+    void* iodata;
+    void* codewritedata;
+    unsigned long sharedaccesses;
+    int variant;
+    struct ARENA* arena;
+    bool busexact;
+    void (*busaccess)(word address, byte data, bool write);
+#ifdef STATS
+    struct CPUSTATS stats;
+#endif
+};
+
+void savecontext(struct CPUCONTEXT* c);
+void loadcontext(const struct CPUCONTEXT* c);
 
 #endif // CPU_H_INCLUDED
@@ -0,0 +1,143 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "6502.h"
+#include "batch.h"
+
+bool loadrom(const char* path, byte* mem, unsigned long org)
+{
+    FILE* f = fopen(path, "rb");
+    long len;
+    unsigned long start;
+    bool ok;
+
+    if(!f) return false;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(len <= 0 || len > 0x10000) //Before working out start, which would wrap around
+	{
+	    fclose(f);
+	    return false;
+	}
+
+    start = (org == 0x10000) ? 0x10000 - len : org;
+    ok = start <= (unsigned long) (0x10000 - len) && fread(mem + start, 1, len, f) == (size_t) len; //start + len could wrap
+    fclose(f);
+
+    return ok;
+}
+
+unsigned long addressarg(const char* s, char stop)
+{
+    char* end;
+    unsigned long address = strtoul(s, &end, 16);
+
+    if(end == s || *end != stop || address > 0xffff)
+	{
+	    fprintf(stderr, "%s isn't an address (Hex, 0 to ffff)\n", s);
+	    exit(2);
+	}
+
+    return address;
+}
+
+static int byname(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+void addroms(const char* path, void (*add)(const char* rom))
+{
+    struct stat st;
+    DIR* d;
+    struct dirent* e;
+    char** names = NULL;
+    int n = 0, i;
+
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+	    add(path); //Missing files too, so they're reported
+	    return;
+	}
+
+    d = opendir(path);
+    if(!d) return;
+
+    while((e = readdir(d)))
+	{
+	    char* full = malloc(strlen(path) + strlen(e->d_name) + 2);
+
+	    sprintf(full, "%s/%s", path, e->d_name);
+	    if(stat(full, &st) == 0 && S_ISREG(st.st_mode))
+		{
+		    names = realloc(names, (n + 1) * sizeof(char*));
+		    names[n++] = full;
+		}
+	    else free(full);
+	}
+    closedir(d);
+
+    qsort(names, n, sizeof(char*), &(byname)); //Same order every time, whatever the file system does
+    for(i = 0; i < n; i++)
+	{
+	    add(names[i]);
+	    free(names[i]);
+	}
+    free(names);
+}
+
+void printquoted(const char* s)
+{
+    putchar('"');
+    for(; *s; s++)
+	{
+	    if(*s == '"' || *s == '\\') printf("\\%c", *s);
+	    else if((unsigned char) *s < 0x20) printf("\\u%04x", *s);
+	    else putchar(*s);
+	}
+    putchar('"');
+}
+
+int runpool(int threads, void* (*worker)(void* arg))
+{
+    pthread_t* pool = malloc(threads * sizeof(pthread_t));
+    int started, i;
+
+    for(started = 0; pool && started < threads; started++) if(pthread_create(&(pool[started]), NULL, worker, NULL) != 0) break;
+    if(started < threads) fprintf(stderr, "started %d of %d threads\n", started, threads);
+    if(!started) worker(NULL); //Nothing else will take the work
+    for(i = 0; i < started; i++) pthread_join(pool[i], NULL);
+
+    free(pool);
+    return started;
+}
@@ -0,0 +1,43 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+
+#include "6502.h"
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+/*
+ * What the batch tools (run6502.c, difftest.c) share: loading a ROM image, expanding the command line into
+ * ROMs, quoting names for their JSON, and starting the worker threads
+ */
+
+bool loadrom(const char* path, byte* mem, unsigned long org); //Into 64 KiB at mem. org 0x10000 ends it at the top of memory
+unsigned long addressarg(const char* s, char stop); //s in hex, up to stop. Exits with a message unless it's 0 to ffff
+void addroms(const char* path, void (*add)(const char* rom)); //path, or every file in it (Sorted by name) if it's a directory
+void printquoted(const char* s); //s as a JSON string, quotes included
+
+int runpool(int threads, void* (*worker)(void* arg)); //Runs worker on that many threads and waits for them. Returns how many started
+
+#endif // BATCH_H_INCLUDED
@@ -0,0 +1,334 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+/*
+ * Cycle-exact core. The handlers are generated from the same OPCODES lists as the fast core in 6502.c and call
+ * the same operations (ADC, ROL, ...), but every bus cycle is a separate busread()/buswrite(), in the order
+ * the NMOS 6502 makes them. cycles counts bus accesses, so page crossings and taken branches cost what they should
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "6502.h"
+
+CPU_LOCAL bool busexact;
+CPU_LOCAL void (*busaccess)(word address, byte data, bool write);
+
+static CPU_LOCAL opcode* bustable;
+
+static inline byte busread(word address)
+{
+    byte flags = pageflags[HIGHBYTE(address)];
+    byte data;
+
+    if(flags & PAGE_SHARED) sharedaccesses++;
+    if(flags & PAGE_IO)
+	{
+	    COUNT(stats.ioaccesses++);
+	    data = ioread(address);
+	}
+    else data = getpage(address)[LOWBYTE(address)];
+
+    if(busaccess) busaccess(address, data, false);
+    cycles++;
+
+    return data;
+}
+
+static inline void buswrite(word address, byte data)
+{
+    byte flags = pageflags[HIGHBYTE(address)];
+
+    if(flags & PAGE_SHARED) sharedaccesses++;
+    if(flags & PAGE_IO)
+	{
+	    COUNT(stats.ioaccesses++);
+	    iowrite(address, data);
+	}
+    else
+	{
+	    byte* page = writepage(address);
+
+	    if(page) page[LOWBYTE(address)] = data;
+	}
+
+    if(busaccess) busaccess(address, data, true);
+    cycles++;
+}
+
+static inline byte fetch() //Next byte at PC
+{
+    byte b = busread(registers.pc);
+
+    registers.pc = WORDPLUS(registers.pc, 1);
+    return b;
+}
+
+static inline void buspush(byte b) { buswrite(BtoW(registers.sp--, 1), b); }
+static inline byte buspull() { return busread(BtoW(++registers.sp, 1)); }
+static inline void idle() { busread(registers.pc); } //Single byte instructions still read the next byte
+
+/*
+ * Addressing modes. write is true for stores and read-modify-write, which always take the indexing cycle;
+ * reads only take it when the index crosses a page. That cycle reads from the address before the carry into the high byte
+ */
+static inline word indexed(word base, byte index, bool write)
+{
+    word address = WORDPLUS(base, index);
+
+    if(write || HIGHBYTE(address) != HIGHBYTE(base)) busread(BtoW((byte) (LOWBYTE(base) + index), HIGHBYTE(base)));
+
+    return address;
+}
+
+static inline word busimm(bool write) { word address = registers.pc; registers.pc = WORDPLUS(registers.pc, 1); return address; }
+static inline word buszp(bool write) { return BtoW(fetch(), 0); }
+static inline word buszpx(bool write) { byte b = fetch(); busread(BtoW(b, 0)); return BtoW((byte) (b + registers.x), 0); }
+static inline word buszpy(bool write) { byte b = fetch(); busread(BtoW(b, 0)); return BtoW((byte) (b + registers.y), 0); }
+static inline word busabs(bool write) { byte low = fetch(); return BtoW(low, fetch()); }
+static inline word busabsx(bool write) { return indexed(busabs(write), registers.x, write); }
+static inline word busabsy(bool write) { return indexed(busabs(write), registers.y, write); }
+
+static inline word busindx(bool write)
+{
+    byte b = fetch();
+    byte low;
+
+    busread(BtoW(b, 0));
+    b += registers.x;
+    low = busread(BtoW(b, 0));
+
+    return BtoW(low, busread(BtoW((byte) (b + 1), 0)));
+}
+
+static inline word busindy(bool write)
+{
+    byte b = fetch();
+    byte low = busread(BtoW(b, 0));
+
+    return indexed(BtoW(low, busread(BtoW((byte) (b + 1), 0))), registers.y, write);
+}
+
+//Handler generators, the bus versions of the ones in 6502.c
+#define ALU(name, mode, reg) static void name##mode##b() { name(busread(bus##mode(false)), &(registers.reg)); }
+#define LOAD(name, mode, reg) static void name##mode##b() { MOV(busread(bus##mode(false)), &(registers.reg), true); }
+#define COMPARE(name, mode, reg) static void name##mode##b() { CMP(registers.reg, busread(bus##mode(false))); }
+#define TEST(name, mode, reg) static void name##mode##b() { BIT(registers.reg, busread(bus##mode(false))); }
+#define STORE(name, mode, reg) static void name##mode##b() { buswrite(bus##mode(true), registers.reg); }
+#define WRITE(name, mode, reg) static void name##mode##b() { buswrite(bus##mode(true), name()); }
+#define SKIP(name, mode, reg) static void name##mode##b() { busread(bus##mode(false)); }
+#define IMPLIED(name, mode, reg)
+
+//RMW writes the unchanged value back while the ALU works, then the result
+#define MODIFY(name, mode, reg)					\
+    static void name##mode##b()					\
+    {								\
+	word address = bus##mode(true);				\
+	byte value = busread(address);				\
+								\
+	buswrite(address, value);				\
+	name(&value);						\
+	buswrite(address, value);				\
+    }
+
+#define PROTO(name, mode, kind, reg, c, l, t) static void name##mode##b();
+OPCODES(PROTO)
+ILLEGAL_OPCODES(PROTO)
+#undef PROTO
+
+#define HANDLER(name, mode, kind, reg, c, l, t) kind(name, mode, reg)
+OPCODES(HANDLER)
+ILLEGAL_OPCODES(HANDLER)
+#undef HANDLER
+
+#define ENTRY(name, mode, kind, reg, c, l, t) [c] = { .code = c, .op = &(name##mode##b), .len = l, .time = t },
+static opcode nmosbus[256] = { OPCODES(ENTRY) };
+static opcode illegalbus[256] = { OPCODES(ENTRY) ILLEGAL_OPCODES(ENTRY) };
+#undef ENTRY
+
+static void implied(void (*op)()) { idle(); op(); } //Reuses the fast handler for the work, which doesn't touch the bus
+
+static void ASLaccb() { implied(&(ASLaccf)); }
+static void LSRaccb() { implied(&(LSRaccf)); }
+static void ROLaccb() { implied(&(ROLaccf)); }
+static void RORaccb() { implied(&(RORaccf)); }
+
+static void CLCb() { implied(&(CLCf)); }
+static void SECb() { implied(&(SECf)); }
+static void CLIb() { implied(&(CLIf)); }
+static void SEIb() { implied(&(SEIf)); }
+static void CLVb() { implied(&(CLVf)); }
+static void CLDb() { implied(&(CLDf)); }
+static void SEDb() { implied(&(SEDf)); }
+
+static void NOPb() { idle(); }
+
+static void TAXb() { implied(&(TAXf)); }
+static void TXAb() { implied(&(TXAf)); }
+static void DEXb() { implied(&(DEXf)); }
+static void INXb() { implied(&(INXf)); }
+static void TAYb() { implied(&(TAYf)); }
+static void TYAb() { implied(&(TYAf)); }
+static void DEYb() { implied(&(DEYf)); }
+static void INYb() { implied(&(INYf)); }
+static void TXSb() { implied(&(TXSf)); }
+static void TSXb() { implied(&(TSXf)); }
+
+static void branch(bool taken)
+{
+    word from = registers.pc;
+    signed char offset = fetch();
+
+    if(taken)
+	{
+	    word target = WORDPLUS(registers.pc, offset);
+
+	    busread(registers.pc);
+	    if(HIGHBYTE(target) != HIGHBYTE(registers.pc)) busread(BtoW(LOWBYTE(target), HIGHBYTE(registers.pc))); //Fixing up the high byte takes another cycle
+	    registers.pc = target;
+	}
+    COVER(from, registers.pc);
+}
+
+static void BPLb() { branch(!registers.p.n); }
+static void BMIb() { branch(registers.p.n); }
+static void BVCb() { branch(!registers.p.v); }
+static void BVSb() { branch(registers.p.v); }
+static void BCCb() { branch(!registers.p.c); }
+static void BCSb() { branch(registers.p.c); }
+static void BNEb() { branch(!registers.p.z); }
+static void BEQb() { branch(registers.p.z); }
+
+static void JMPabsb() { word from = registers.pc; registers.pc = busabs(false); COVER(from, registers.pc); }
+
+static void JMPindb()
+{
+    word from = registers.pc;
+    word pointer = busabs(false);
+    byte low = busread(pointer);
+
+    registers.pc = BtoW(low, busread(BtoW((byte) (LOWBYTE(pointer) + 1), HIGHBYTE(pointer)))); //Same page bug as the fast core
+    COVER(from, registers.pc);
+}
+
+static void JSRb()
+{
+    word from = registers.pc;
+    byte low = fetch();
+
+    busread(BtoW(registers.sp, 1)); //Internal cycle, the stack pointer is on the bus
+    buspush(HIGHBYTE(registers.pc)); //PC is at the high byte of the operand, which is what RTS expects
+    buspush(LOWBYTE(registers.pc));
+    registers.pc = BtoW(low, busread(registers.pc));
+    COVER(from, registers.pc);
+}
+
+static void RTSb()
+{
+    word from = registers.pc;
+    byte low;
+
+    idle();
+    busread(BtoW(registers.sp, 1));
+    low = buspull();
+    registers.pc = BtoW(low, buspull());
+    fetch(); //Reads the last byte of the JSR while stepping past it
+    COVER(from, registers.pc);
+}
+
+static void RTIb()
+{
+    byte p, low;
+
+    idle();
+    busread(BtoW(registers.sp, 1));
+    p = buspull(); //BtoP() uses its argument once per flag
+    registers.p = BtoP(p);
+    low = buspull();
+    registers.pc = BtoW(low, buspull());
+}
+
+static void PHAb() { idle(); buspush(registers.ac); }
+static void PHPb() { idle(); buspush(PtoB(registers.p, 1)); }
+static void PLAb() { idle(); busread(BtoW(registers.sp, 1)); MOV(buspull(), &(registers.ac), true); }
+static void PLPb() { byte p; idle(); busread(BtoW(registers.sp, 1)); p = buspull(); registers.p = BtoP(p); }
+
+static void vector(word pc, bool brk, word address) //Shared tail of BRK, IRQ and NMI
+{
+    byte low;
+
+    buspush(HIGHBYTE(pc));
+    buspush(LOWBYTE(pc));
+    buspush(PtoB(registers.p, brk));
+    registers.p.i = true;
+    low = busread(address);
+    registers.pc = BtoW(low, busread(WORDPLUS(address, 1)));
+}
+
+static void BRKb() { fetch(); COUNT(stats.interrupts++); vector(registers.pc, true, 0xfeff); }
+
+void businterrupt(int type)
+{
+    idle();
+    idle();
+    vector(registers.pc, type == 2, (type == 1) ? 0xfaff : 0xfeff);
+}
+
+bool setbusmode(bool exact)
+{
+    if(exact && variant == CPU_65C02) return false; //Its RMW and dummy cycles are different, and aren't modelled here
+
+    bustable = (variant == CPU_NMOSX) ? illegalbus : nmosbus;
+    busexact = exact;
+    return true;
+}
+
+void nextbus()
+{
+    byte code = fetch();
+    opcode* o = &(bustable[code]);
+
+    COUNT(stats.retired++);
+    COUNT(stats.opcodes[code]++);
+
+    if(o->op) o->op();
+    else idle(); //Unknown opcodes act as NOP, like in the fast core
+}
+
+unsigned long runbus(unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    if(nextevent && nextevent < end) end = nextevent;
+
+    while(cycles < end) //No idle loop skipping, devices want to see every cycle
+	{
+	    nextbus();
+	    if(nextevent && nextevent < end) end = nextevent;
+	}
+
+    return cycles - begin;
+}
@@ -0,0 +1,366 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "6502.h"
+#include "cfg.h"
+
+static void setbit(byte* map, word address)
+{
+    map[BIG(address) >> 3] |= 1 << (BIG(address) & 7);
+}
+
+static bool fetchable(word address) //Safe to decode: reading it has no side effects, and writes to it are seen
+{
+    byte page = HIGHBYTE(address);
+
+    return page != 1 && !(pageflags[page] & PAGE_IO);
+}
+
+static opcode* decodeat(struct CFG* c, word address) //The table entry for the instruction at address, or NULL
+{
+    opcode* o;
+    word last;
+
+    if(!fetchable(address)) return NULL;
+    o = &(c->table[readb(address)]);
+    if(!o->op) return NULL; //next() would run it as a NOP, but it's more likely we've walked into data
+
+    last = WORDPLUS(address, o->len - 1);
+    return fetchable(last) ? o : NULL;
+}
+
+static int exitof(opcode* o, word address, word* target) //EXIT_* for the instruction, or EXIT_FALL if it doesn't jump
+{
+    word next = WORDPLUS(address, o->len);
+    word operand = WORDPLUS(address, 1);
+    word last = WORDPLUS(address, o->len - 1);
+
+    if(o->op == &(JMPabsf) || o->op == &(JSRf))
+	{
+	    *target = readw(operand);
+	    return (o->op == &(JSRf)) ? EXIT_CALL : EXIT_JUMP;
+	}
+    if(o->op == &(RTSf) || o->op == &(RTIf) || o->op == &(BRKf)) return EXIT_RETURN;
+    if(o->op == &(JMPindf) || o->op == &(JMPCindf) || o->op == &(JMPiabsxf)) return EXIT_INDIRECT;
+
+    if(o->op == &(BPLf) || o->op == &(BMIf) || o->op == &(BVCf) || o->op == &(BVSf) || o->op == &(BCCf) ||
+       o->op == &(BCSf) || o->op == &(BNEf) || o->op == &(BEQf) || o->op == &(BRAf) ||
+       (variant == CPU_65C02 && (o->code & 0x0f) == 0x0f)) //BBR and BBS, offset in their last byte
+	{
+	    *target = WORDPLUS(next, (signed char) readb(last));
+	    return (o->op == &(BRAf)) ? EXIT_JUMP : EXIT_BRANCH;
+	}
+
+    return EXIT_FALL;
+}
+
+static void mark(struct CFG* c, word address, int len)
+{
+    int i;
+
+    setbit(c->starts, address);
+    for(i = 0; i < len; i++) setbit(c->code, WORDPLUS(address, i));
+    pageflags[HIGHBYTE(address)] |= PAGE_CODE;
+}
+
+static void push(struct CFG* c, word address, word* stack, int* top)
+{
+    if(CFGBIT(c->leaders, address)) return; //Already been queued
+    setbit(c->leaders, address);
+    stack[(*top)++] = address;
+}
+
+/*
+ * Recursive descent, with a stack of leaders still to walk. Every address is queued at most once,
+ * so the stack never needs more than 64K entries
+ */
+static void walk(struct CFG* c, word root)
+{
+    word* stack = malloc(0x10000 * sizeof(word));
+    int top = 0;
+
+    if(!stack) return;
+
+    push(c, root, stack, &top);
+    while(top)
+	{
+	    word address = stack[--top];
+
+	    while(!CFGBIT(c->starts, address))
+		{
+		    opcode* o = decodeat(c, address);
+		    word next, target;
+		    int exit;
+
+		    if(!o) break;
+		    mark(c, address, o->len);
+		    next = WORDPLUS(address, o->len);
+		    exit = exitof(o, address, &target);
+
+		    if(exit == EXIT_BRANCH || exit == EXIT_JUMP || exit == EXIT_CALL) push(c, target, stack, &top);
+		    if(exit == EXIT_BRANCH || exit == EXIT_CALL) push(c, next, stack, &top);
+		    if(exit != EXIT_FALL) break;
+		    address = next;
+		}
+	}
+
+    free(stack);
+}
+
+static struct BLOCK* makeblock(struct CFG* c, word start)
+{
+    struct BLOCK* b;
+    word address = start;
+
+    b = malloc(sizeof(struct BLOCK));
+    if(!b) return NULL;
+    b->start = start;
+    b->target = 0;
+    b->exit = EXIT_FALL;
+    b->count = 0;
+    b->dead = false;
+    b->time = 0;
+
+    while(b->count < BLOCK_MAX)
+	{
+	    opcode* o = decodeat(c, address);
+	    int exit;
+
+	    if(!o)
+		{
+		    b->exit = EXIT_STOP;
+		    break;
+		}
+
+	    mark(c, address, o->len);
+	    b->ops[b->count++] = o;
+	    b->time += o->time;
+	    exit = exitof(o, address, &(b->target));
+	    address = WORDPLUS(address, o->len);
+
+	    if(exit != EXIT_FALL)
+		{
+		    b->exit = exit;
+		    break;
+		}
+	    if(CFGBIT(c->leaders, address)) break;
+	}
+
+    if(!b->count)
+	{
+	    free(b);
+	    return NULL;
+	}
+
+    b->end = address;
+    if(b->exit == EXIT_FALL) setbit(c->leaders, address); //The block was full, so the next one starts there
+
+    if(!cfginsert(c, b))
+	{
+	    free(b);
+	    return NULL;
+	}
+
+    return b;
+}
+
+static int makeblocks(struct CFG* c) //A block for every leader the walk reached
+{
+    int before = c->count;
+    int i;
+
+    for(i = 0; i < 0x10000; i++)
+	{
+	    word address = LITTLE(i);
+
+	    if(CFGBIT(c->leaders, address) && CFGBIT(c->starts, address) && !cfgblock(c, address)) makeblock(c, address);
+	}
+
+    return c->count - before;
+}
+
+static void kill(struct CFG* c, struct BLOCK* b)
+{
+    if(b->prev) b->prev->next = b->next;
+    else c->blocks = b->next;
+    if(b->next) b->next->prev = b->prev;
+
+    c->map[HIGHBYTE(b->start)][LOWBYTE(b->start)] = NULL;
+    b->dead = true;
+    b->next = c->dead; //It may be running, so it's freed later
+    c->dead = b;
+    c->count--;
+    c->stale = true;
+}
+
+static void sweep(struct CFG* c)
+{
+    while(c->dead)
+	{
+	    struct BLOCK* b = c->dead;
+
+	    c->dead = b->next;
+	    free(b);
+	}
+}
+
+static void overwrite(word address, int len) //codewrite() handler
+{
+    struct CFG* c = codewritedata;
+    int i, j;
+
+    for(i = 0; i < len; i++)
+	{
+	    word at = WORDPLUS(address, i);
+
+	    if(!CFGBIT(c->starts, at)) continue; //Operands and data are read as the code runs, so they don't matter
+
+	    for(j = 0; j < BLOCK_BYTES; j++) //Every block that could hold the opcode
+		{
+		    word from = WORDPLUS(at, -j);
+		    struct BLOCK* b = cfgblock(c, from);
+
+		    if(b && (word) (BIG(at) - BIG(b->start)) < (word) (BIG(b->end) - BIG(b->start))) kill(c, b);
+		}
+	}
+}
+
+static void flush(struct CFG* c) //Drops every block and what was decoded, keeping the leaders
+{
+    while(c->blocks) kill(c, c->blocks);
+    sweep(c);
+
+    memset(c->code, 0, sizeof(c->code));
+    memset(c->starts, 0, sizeof(c->starts));
+    c->table = optable;
+}
+
+void cfginit(struct CFG* c)
+{
+    memset(c, 0, sizeof(struct CFG));
+    c->table = optable;
+    codewritedata = c;
+    codewrite = &(overwrite);
+}
+
+bool cfginsert(struct CFG* c, struct BLOCK* b)
+{
+    byte page = HIGHBYTE(b->start);
+
+    if(!c->map[page])
+	{
+	    c->map[page] = calloc(0x100, sizeof(struct BLOCK*));
+	    if(!c->map[page]) return false;
+	}
+
+    b->dead = false;
+    b->prev = NULL;
+    b->next = c->blocks;
+    if(c->blocks) c->blocks->prev = b;
+    c->blocks = b;
+    c->map[page][LOWBYTE(b->start)] = b;
+    c->count++;
+
+    return true;
+}
+
+int cfgbuild(struct CFG* c)
+{
+    cfginit(c);
+
+    if(!(pageflags[0xff] & PAGE_IO))
+	{
+	    walk(c, readw(0xfcff));
+	    walk(c, readw(0xfeff));
+	    walk(c, readw(0xfaff));
+	}
+
+    return makeblocks(c);
+}
+
+int cfgroot(struct CFG* c, word address)
+{
+    if(c->table != optable) flush(c);
+    walk(c, address);
+
+    return makeblocks(c);
+}
+
+void cfgfree(struct CFG* c)
+{
+    int i;
+
+    while(c->blocks) kill(c, c->blocks);
+    sweep(c);
+
+    for(i = 0; i < 256; i++)
+	{
+	    free(c->map[i]);
+	    c->map[i] = NULL;
+	    pageflags[i] &= ~PAGE_CODE;
+	}
+
+    codewrite = NULL;
+    codewritedata = NULL;
+}
+
+struct BLOCK* cfgblock(struct CFG* c, word address)
+{
+    struct BLOCK** page = c->map[HIGHBYTE(address)];
+
+    return page ? page[LOWBYTE(address)] : NULL;
+}
+
+unsigned long cfgrun(struct CFG* c, unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    if(busexact) return runbus(n);
+    if(c->table != optable) flush(c);
+    if(nextevent && nextevent < end) end = nextevent;
+
+    while(cycles < end)
+	{
+	    word pc = registers.pc;
+	    struct BLOCK* b = cfgblock(c, pc);
+
+	    if(!b) b = makeblock(c, pc); //Somewhere the walk didn't reach, or the middle of a block
+	    if(b)
+		{
+		    c->stale = false;
+		    nextops(b->ops, b->count, end, &(c->stale));
+		    if(c->dead) sweep(c);
+		}
+	    else next();
+
+	    if(nextevent && nextevent < end) end = nextevent;
+	    idleskip(pc, end); //Same idle loop skipping as run()
+	}
+
+    return cycles - begin;
+}
@@ -0,0 +1,97 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+
+#include "6502.h"
+
+#ifndef CFG_H_INCLUDED
+#define CFG_H_INCLUDED
+
+/*
+ * Static control flow. cfgbuild() walks the code from the reset, IRQ and NMI vectors, following branches,
+ * JMP and JSR, and splits what it finds into basic blocks, each decoded ahead of time into its dispatch table
+ * entries. cfgrun() then runs a block at a time without decoding anything, and blocks for code the walk couldn't
+ * see (Indirect jumps, RTS tables) are decoded the first time the CPU gets there.
+ *
+ * Only opcode bytes are decoded; operands are still read from memory as the code runs, so patching an operand
+ * costs nothing. A write over an opcode drops the blocks holding it, which are decoded again if it's reached.
+ * Code on the stack page isn't decoded, since pushes don't go through writepage()
+ */
+
+#define BLOCK_MAX 32 //Instructions in one block
+#define BLOCK_BYTES (3 * BLOCK_MAX)
+
+//How a block ends
+#define EXIT_FALL 0 //Runs into the next block at end (A leader, or the block was full)
+#define EXIT_BRANCH 1 //Conditional, to target or end
+#define EXIT_JUMP 2 //To target
+#define EXIT_CALL 3 //JSR to target, coming back to end
+#define EXIT_RETURN 4 //RTS, RTI or BRK
+#define EXIT_INDIRECT 5 //A jump through memory, target unknown
+#define EXIT_STOP 6 //The next byte isn't something the table decodes, or is in an I/O or stack page
+
+struct BLOCK
+{
+    word start; //First instruction
+    word end; //The byte after the last one
+    word target; //For EXIT_BRANCH, EXIT_JUMP and EXIT_CALL. Taken from the operand when the block was decoded
+    byte exit;
+    byte count;
+    bool dead; //Overwritten, and freed at the next block boundary
+    unsigned long time; //Cycles through the block, not counting taken branches or page crossings
+
+    struct BLOCK* prev; //Every live block, newest first
+    struct BLOCK* next;
+    opcode* ops[BLOCK_MAX];
+};
+
+struct CFG
+{
+    //Bitmaps by address (BIG() order, so disassemblers can walk them)
+    byte code[0x2000]; //Every byte of a decoded instruction. The rest is data, as far as the walk could tell
+    byte starts[0x2000]; //Opcode bytes
+    byte leaders[0x2000]; //Where a basic block has to start: entry points, targets, and after branches and calls
+
+    struct BLOCK** map[256]; //Block starting at each address, a table per page (NULL until it has a block)
+    struct BLOCK* blocks;
+    struct BLOCK* dead;
+    int count; //Live blocks
+
+    opcode* table; //optable the blocks were decoded from. Changing the variant throws them all away
+    bool stale; //A block was overwritten while it ran
+};
+
+#define CFGBIT(map, address) ((map)[BIG(address) >> 3] & (1 << (BIG(address) & 7)))
+
+int cfgbuild(struct CFG* c); //Starts afresh from the vectors, and takes over codewrite. Returns the blocks found
+void cfginit(struct CFG* c); //Empty, but with codewrite taken over, for filling from elsewhere (See codecache.h)
+bool cfginsert(struct CFG* c, struct BLOCK* b); //Links in a malloc'd block with its ops filled in. False if out of memory
+int cfgroot(struct CFG* c, word address); //Walks from another entry point the host knows about. Returns new blocks
+void cfgfree(struct CFG* c);
+
+struct BLOCK* cfgblock(struct CFG* c, word address); //The block starting at address, or NULL
+
+unsigned long cfgrun(struct CFG* c, unsigned long n); //run(n) from predecoded blocks (The bus core decodes as it goes)
+
+#endif // CFG_H_INCLUDED
@@ -0,0 +1,304 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "6502.h"
+#include "cfg.h"
+#include "codecache.h"
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+struct CACHEHEADER
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t core;
+    uint32_t variant;
+    uint32_t blocks;
+    uint32_t blockmax;
+    uint32_t pad;
+    uint64_t key;
+};
+
+struct CACHEBLOCK
+{
+    uint16_t start, end, target;
+    uint8_t exit;
+    uint8_t count;
+    uint8_t codes[BLOCK_MAX];
+};
+
+#define BITMAPS (3 * 0x2000)
+
+static uint64_t fnv(uint64_t h, const byte* data, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++) h = (h ^ data[i]) * FNV_PRIME;
+    return h;
+}
+
+static bool fetchable(word address) //Same rule as the decoder
+{
+    byte page = HIGHBYTE(address);
+
+    return page != 1 && !(pageflags[page] & PAGE_IO);
+}
+
+static bool empty(const byte* bits, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++) if(bits[i]) return false;
+    return true;
+}
+
+static void pathof(char* path, size_t size, const char* dir, uint64_t key)
+{
+    snprintf(path, size, "%s/%016llx.cfg", dir, (unsigned long long) key);
+}
+
+//What the walk starts from: the versions, which pages can be decoded, and the vectors. The file is named after it
+static uint64_t rootkey()
+{
+    uint32_t versions[3] = { CODECACHE_VERSION, CORE_VERSION, variant };
+    uint64_t h = fnv(FNV_BASIS, (const byte*) versions, sizeof(versions));
+    byte pages[32] = { 0 };
+    byte vectors[6] = { 0 };
+    int i;
+
+    for(i = 0; i < 256; i++) if(fetchable(BtoW(0, i))) pages[i >> 3] |= 1 << (i & 7);
+    h = fnv(h, pages, sizeof(pages));
+
+    if(fetchable(0xfaff)) for(i = 0; i < 6; i++) vectors[i] = readb(BtoW(0xfa + i, 0xff));
+    return fnv(h, vectors, sizeof(vectors));
+}
+
+uint64_t codecachekey(const struct CFG* c)
+{
+    uint64_t h = rootkey();
+    int i;
+
+    for(i = 0; i < 256; i++)
+	{
+	    byte page = i;
+
+	    if(empty(c->code + 0x20 * i, 0x20)) continue; //Nothing decoded from it, so its bytes didn't shape the graph
+	    h = fnv(h, &page, 1);
+	    h = fnv(h, getpage(BtoW(0, i)), 0x100);
+	}
+
+    return h;
+}
+
+//Rebuilds one block from its record, checking it against memory. NULL if it doesn't match
+static struct BLOCK* unpack(const struct CACHEBLOCK* r)
+{
+    struct BLOCK* b;
+    word address = LITTLE(r->start);
+    int i;
+
+    if(r->count == 0 || r->count > BLOCK_MAX || r->exit > EXIT_STOP) return NULL;
+
+    b = malloc(sizeof(struct BLOCK));
+    if(!b) return NULL;
+    b->start = address;
+    b->target = LITTLE(r->target);
+    b->exit = r->exit;
+    b->count = r->count;
+    b->time = 0;
+
+    for(i = 0; i < r->count; i++)
+	{
+	    opcode* o = &(optable[r->codes[i]]);
+
+	    if(!o->op || !fetchable(address) || readb(address) != r->codes[i])
+		{
+		    free(b);
+		    return NULL;
+		}
+	    b->ops[i] = o;
+	    b->time += o->time;
+	    address = WORDPLUS(address, o->len);
+	}
+
+    b->end = address;
+    if(BIG(address) != r->end)
+	{
+	    free(b);
+	    return NULL;
+	}
+
+    return b;
+}
+
+static bool readall(int fd, void* buf, size_t len)
+{
+    byte* p = buf;
+
+    while(len)
+	{
+	    ssize_t n = read(fd, p, len);
+
+	    if(n <= 0) return false;
+	    p += n;
+	    len -= n;
+	}
+
+    return true;
+}
+
+bool codecacheload(struct CFG* c, const char* dir)
+{
+    char path[4096];
+    struct stat st;
+    struct CACHEHEADER h;
+    struct CACHEBLOCK r;
+    void (*oldwrite)(word address, int len) = codewrite;
+    void* olddata = codewritedata;
+    byte codepages[256]; //PAGE_CODE as it was, for putting back if the file is no good
+    uint32_t i;
+    int fd, page;
+    bool ok;
+
+    pathof(path, sizeof(path), dir, rootkey());
+    fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+    if(fstat(fd, &st) < 0 || !readall(fd, &h, sizeof(h)) || memcmp(h.magic, "F652CFG", 8) != 0 ||
+       h.version != CODECACHE_VERSION || h.core != CORE_VERSION || h.variant != (uint32_t) variant ||
+       h.blockmax != BLOCK_MAX ||
+       (size_t) st.st_size != sizeof(struct CACHEHEADER) + BITMAPS + h.blocks * sizeof(struct CACHEBLOCK))
+	{
+	    close(fd);
+	    return false;
+	}
+
+    for(page = 0; page < 256; page++) codepages[page] = pageflags[page] & PAGE_CODE;
+
+    cfginit(c);
+    ok = readall(fd, c->code, 0x2000) && readall(fd, c->starts, 0x2000) && readall(fd, c->leaders, 0x2000) &&
+	codecachekey(c) == h.key; //Once the code bitmap says which pages to hash
+
+    for(i = 0; i < h.blocks && ok; i++) //One record at a time, straight into the blocks
+	{
+	    struct BLOCK* b = readall(fd, &r, sizeof(r)) ? unpack(&r) : NULL;
+
+	    if(!b || cfgblock(c, b->start) || !cfginsert(c, b))
+		{
+		    free(b);
+		    ok = false;
+		}
+	}
+    close(fd);
+
+    if(!ok)
+	{
+	    cfgfree(c);
+	    codewrite = oldwrite; //cfgfree() let go of whatever had the hook before, so it gets it back
+	    codewritedata = olddata;
+	    for(page = 0; page < 256; page++) pageflags[page] |= codepages[page];
+	    return false;
+	}
+
+    //Writes over the opcodes are reported from now on, the same as after cfgbuild()
+    for(page = 0; page < 256; page++) if(!empty(c->starts + 0x20 * page, 0x20)) pageflags[page] |= PAGE_CODE;
+
+    return true;
+}
+
+static bool writeall(int fd, const void* buf, size_t len)
+{
+    const byte* p = buf;
+
+    while(len)
+	{
+	    ssize_t n = write(fd, p, len);
+
+	    if(n <= 0) return false;
+	    p += n;
+	    len -= n;
+	}
+
+    return true;
+}
+
+bool codecachesave(const struct CFG* c, const char* dir)
+{
+    struct CACHEHEADER h;
+    struct CACHEBLOCK* records = malloc((c->count ? c->count : 1) * sizeof(struct CACHEBLOCK));
+    const struct BLOCK* b;
+    char path[4096], temp[4096 + 8];
+    int fd, i, n = 0;
+    bool ok;
+
+    if(!records) return false;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "F652CFG", 8);
+    h.version = CODECACHE_VERSION;
+    h.core = CORE_VERSION;
+    h.variant = variant;
+    h.blockmax = BLOCK_MAX;
+    h.key = codecachekey(c);
+
+    for(b = c->blocks; b; b = b->next)
+	{
+	    struct CACHEBLOCK* r = &(records[n++]);
+
+	    memset(r, 0, sizeof(struct CACHEBLOCK));
+	    r->start = BIG(b->start);
+	    r->end = BIG(b->end);
+	    r->target = BIG(b->target);
+	    r->exit = b->exit;
+	    r->count = b->count;
+	    for(i = 0; i < b->count; i++) r->codes[i] = b->ops[i]->code;
+	}
+    h.blocks = n;
+
+    pathof(path, sizeof(path), dir, rootkey());
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", path); //Unique, even for threads of one process saving the same image
+    fd = mkstemp(temp);
+    if(fd < 0)
+	{
+	    free(records);
+	    return false;
+	}
+
+    ok = fchmod(fd, 0644) == 0 && writeall(fd, &h, sizeof(h)) && writeall(fd, c->code, 0x2000) && writeall(fd, c->starts, 0x2000) &&
+	writeall(fd, c->leaders, 0x2000) && writeall(fd, records, n * sizeof(struct CACHEBLOCK));
+    ok = (close(fd) == 0) && ok;
+    free(records);
+
+    if(ok) ok = (rename(temp, path) == 0); //Atomic, so a reader sees the old file or the whole new one
+    if(!ok) unlink(temp);
+    return ok;
+}
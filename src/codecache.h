@@ -0,0 +1,57 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "6502.h"
+#include "cfg.h"
+
+#ifndef CODECACHE_H_INCLUDED
+#define CODECACHE_H_INCLUDED
+
+/*
+ * The control flow graph and decoded blocks of cfg.h, kept on disk so the next launch of the same image can skip
+ * the walk. Caches live in a directory, one file per image, named after a 64-bit FNV-1a hash of where the walk
+ * starts: the variant, the core version, which pages can be decoded and the vectors. The key inside extends that
+ * hash with the pages holding decoded code, and nothing else, so RAM and data that differ from one launch to the
+ * next don't miss the cache. Loading reads the file straight into a CFG, checking the key and every opcode byte
+ * against memory, and the CFG then handles writes to code pages like a built one. A file that fails the checks
+ * leaves codewrite and PAGE_CODE as they were. Save before code is loaded into RAM, or that RAM has to hold the
+ * same code next time too. Files are in the host's byte order, and are written under a temporary name and
+ * renamed, so instances sharing a directory never see half a file
+ *
+ * Layout:
+ *   "F652CFG", version, CORE_VERSION, variant, block count, BLOCK_MAX (4 bytes each), key (8 bytes)
+ *   The code, starts and leaders bitmaps
+ *   For each block: start, end, target (2 bytes each, BIG() order), exit, count, then BLOCK_MAX opcode bytes
+ */
+
+#define CODECACHE_VERSION 2
+
+uint64_t codecachekey(const struct CFG* c); //For the pages c decoded code from, as they are in memory now
+
+bool codecacheload(struct CFG* c, const char* dir); //False if there's no valid cache, and c should be cfgbuild() instead
+bool codecachesave(const struct CFG* c, const char* dir);
+
+#endif // CODECACHE_H_INCLUDED
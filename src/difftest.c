@@ -0,0 +1,361 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+/*
+ * Differential tester. Runs the real core and the reference core (refcore.c) in lockstep over the same ROMs,
+ * one instruction at a time, and compares registers, flags, the bytes each instruction wrote and cycle counts,
+ * on the fast core or (With -b) the cycle-exact bus core. The first divergence is reported with the instructions that led up
+ * to it. ROMs are spread over worker threads like run6502; one line of JSON per ROM, in the order given.
+ *
+ * Build: cc -O2 -pthread difftest.c refcore.c batch.c 6502.c buscore.c -o difftest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "6502.h"
+#include "batch.h"
+#include "refcore.h"
+
+#define MAX_CONTEXT 64
+#define MAX_INPUTS 16
+
+struct STEP
+{
+    word pc; //Swapped, like registers.pc
+    byte code[3];
+    struct CPUREGS regs; //After the instruction
+    unsigned long cycles;
+};
+
+struct RESULT
+{
+    char* rom;
+    const char* status; //"match", "diverged", "unsupported", "loop" or "error"
+    unsigned long steps; //Instructions both cores ran
+    const char* field; //What differed: "pc", "a", "x", "y", "sp", "p", "memory" or "cycles"
+    int address; //For "memory"
+    int corevalue, refvalue;
+    struct CPUREGS regs;
+    struct REFCPU* ref; //Kept only when they diverged
+    struct STEP context[MAX_CONTEXT];
+    int ncontext;
+};
+
+struct INPUT
+{
+    unsigned long address;
+    const char* path;
+};
+
+//Options, shared by every worker
+static unsigned long org = 0x10000; //0x10000 means "end the ROM at the top of memory"
+static long resetvector = -1;
+static unsigned long limit = 10000000; //Instructions
+static bool bus = false;
+static int contextlen = 8;
+static struct INPUT inputs[MAX_INPUTS];
+static int ninputs;
+
+static struct RESULT* results;
+static int count;
+static atomic_int nextrom;
+
+static CPU_LOCAL byte* mem; //Each worker's memory for the real core, mapped into its memorymap
+
+static void record(struct RESULT* r, struct STEP* ring, unsigned long n)
+{
+    int i, first = (n > (unsigned long) contextlen) ? n - contextlen : 0;
+
+    r->ncontext = 0;
+    for(i = first; (unsigned long) i < n; i++) r->context[r->ncontext++] = ring[i % contextlen];
+}
+
+//Fills in field and the two values if they differ. Only called after both cores ran the same instruction
+static bool compare(struct RESULT* r, struct REFCPU* ref, unsigned long coredelta, unsigned long refdelta)
+{
+    byte p = PtoB(registers.p, 1) | 0x30;
+    int pages[REF_WRITES + 256];
+    int npages = 0, i;
+
+    if(BIG(registers.pc) != ref->pc) { r->field = "pc"; r->corevalue = BIG(registers.pc); r->refvalue = ref->pc; return false; }
+    if(registers.ac != ref->a) { r->field = "a"; r->corevalue = registers.ac; r->refvalue = ref->a; return false; }
+    if(registers.x != ref->x) { r->field = "x"; r->corevalue = registers.x; r->refvalue = ref->x; return false; }
+    if(registers.y != ref->y) { r->field = "y"; r->corevalue = registers.y; r->refvalue = ref->y; return false; }
+    if(registers.sp != ref->s) { r->field = "sp"; r->corevalue = registers.sp; r->refvalue = ref->s; return false; }
+    if(p != (ref->p | 0x30)) { r->field = "p"; r->corevalue = p; r->refvalue = ref->p | 0x30; return false; } //B isn't a real flag
+
+    //Every page either core wrote: the core's dirty bits catch its stray writes, the ref's list the ones it missed
+    for(i = 0; i < ref->nwrites; i++) pages[npages++] = ref->writes[i] >> 8;
+    for(i = 0; i < 256; i++)
+	{
+	    if(dirty[i]) pages[npages++] = i;
+	    dirty[i] = 0;
+	}
+    for(i = 0; i < npages; i++)
+	{
+	    const byte* a = mem + 0x100 * pages[i];
+	    const uint8_t* b = ref->mem + 0x100 * pages[i];
+	    int j;
+
+	    if(memcmp(a, b, 0x100) == 0) continue;
+	    for(j = 0; a[j] == b[j]; j++);
+	    r->field = "memory";
+	    r->address = 0x100 * pages[i] + j;
+	    r->corevalue = a[j];
+	    r->refvalue = b[j];
+	    return false;
+	}
+
+    if(coredelta != refdelta) { r->field = "cycles"; r->corevalue = coredelta; r->refvalue = refdelta; return false; }
+
+    return true;
+}
+
+static void runrom(struct RESULT* r, struct REFCPU* ref, struct STEP* ring)
+{
+    unsigned long n;
+    int i;
+
+    memset(mem, 0, 0x10000);
+    memorymap.zero = mem;
+    memorymap.stack = mem + 0x100;
+    for(i = 0; i < 254; i++) memorymap.pages[i] = mem + 0x200 + 0x100 * i;
+
+    if(!loadrom(r->rom, mem, org))
+	{
+	    r->status = "error";
+	    return;
+	}
+    for(i = 0; i < ninputs; i++)
+	{
+	    if(!loadrom(inputs[i].path, mem, inputs[i].address))
+		{
+		    r->status = "error";
+		    return;
+		}
+	}
+
+    if(resetvector >= 0)
+	{
+	    mem[0xfffc] = resetvector & 0xff;
+	    mem[0xfffd] = resetvector >> 8;
+	}
+
+    memset(pageflags, 0, sizeof(pageflags));
+    memset(dirty, 0, sizeof(dirty));
+    cycles = 0;
+    nextevent = 0;
+    setvariant(CPU_NMOS);
+    setbusmode(bus);
+    registers.p = BtoP(0x24);
+    reset();
+
+    memcpy(ref->mem, mem, 0x10000);
+    refreset(ref);
+
+    r->status = "match";
+    for(n = 0; n < limit; n++)
+	{
+	    word pc = registers.pc;
+	    unsigned long before = cycles, refbefore = ref->cycles;
+	    struct STEP* s = &(ring[n % contextlen]);
+
+	    if(!refstep(ref))
+		{
+		    r->status = "unsupported";
+		    break;
+		}
+
+	    s->pc = pc;
+	    for(i = 0; i < 3; i++) s->code[i] = mem[(BIG(pc) + i) & 0xffff]; //The ref only touched its own copy
+	    if(bus) nextbus();
+	    else next();
+
+	    s->regs = registers;
+	    s->cycles = cycles - before;
+
+	    if(!compare(r, ref, cycles - before, ref->cycles - refbefore))
+		{
+		    r->status = "diverged";
+		    r->ref = malloc(sizeof(struct REFCPU));
+		    if(r->ref) memcpy(r->ref, ref, sizeof(struct REFCPU) - sizeof(ref->mem)); //Registers only, mem is last
+		    n++;
+		    break;
+		}
+	    if(registers.pc == pc) //Branch or jump to itself. Both agree on it, nothing else will happen
+		{
+		    r->status = "loop";
+		    n++;
+		    break;
+		}
+	}
+
+    r->steps = n;
+    r->regs = registers;
+    record(r, ring, n);
+}
+
+static void* worker(void* arg)
+{
+    struct REFCPU* ref = malloc(sizeof(struct REFCPU));
+    struct STEP* ring = malloc(contextlen * sizeof(struct STEP));
+    int i;
+
+    mem = malloc(0x10000);
+    if(mem && ref && ring)
+	{
+	    while((i = atomic_fetch_add(&nextrom, 1)) < count) runrom(&(results[i]), ref, ring);
+	}
+
+    free(mem);
+    free(ring);
+    free(ref);
+    return NULL;
+}
+
+static void addrom(const char* path) //For addroms()
+{
+    results = realloc(results, (count + 1) * sizeof(struct RESULT));
+    memset(&(results[count]), 0, sizeof(struct RESULT));
+    results[count].rom = strdup(path);
+    results[count].status = "error";
+    count++;
+}
+
+static void printregs(const struct CPUREGS* regs)
+{
+    printf("{\"pc\":%u,\"a\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"p\":%u}",
+	   BIG(regs->pc), regs->ac, regs->x, regs->y, regs->sp, PtoB(regs->p, 1) | 0x30);
+}
+
+static void printjson(const struct RESULT* r)
+{
+    int i;
+
+    printf("{\"rom\":");
+    printquoted(r->rom);
+    printf(",\"status\":\"%s\"", r->status);
+    if(strcmp(r->status, "error") == 0)
+	{
+	    printf("}\n");
+	    return;
+	}
+    printf(",\"instructions\":%lu", r->steps);
+
+    if(strcmp(r->status, "diverged") == 0)
+	{
+	    printf(",\"field\":\"%s\"", r->field);
+	    if(strcmp(r->field, "memory") == 0) printf(",\"address\":%d", r->address);
+	    printf(",\"core\":%d,\"ref\":%d,\"coreregs\":", r->corevalue, r->refvalue);
+	    printregs(&(r->regs));
+	    if(r->ref)
+		printf(",\"refregs\":{\"pc\":%u,\"a\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"p\":%u}",
+		       r->ref->pc, r->ref->a, r->ref->x, r->ref->y, r->ref->s, r->ref->p | 0x30);
+	}
+    else
+	{
+	    printf(",\"regs\":");
+	    printregs(&(r->regs));
+	}
+
+    //The last instructions, oldest first. In a divergence, the last one is where they split
+    printf(",\"context\":[");
+    for(i = 0; i < r->ncontext; i++)
+	{
+	    const struct STEP* s = &(r->context[i]);
+
+	    printf("%s{\"pc\":%u,\"bytes\":\"%02x %02x %02x\",\"cycles\":%lu,\"after\":", i ? "," : "",
+		   BIG(s->pc), s->code[0], s->code[1], s->code[2], s->cycles);
+	    printregs(&(s->regs));
+	    printf("}");
+	}
+    printf("]}\n");
+}
+
+static void usage()
+{
+    fprintf(stderr,
+	    "usage: difftest [options] rom|directory...\n"
+	    "  -o addr       load address (hex, default: end at 0xffff)\n"
+	    "  -r addr       reset vector (hex)\n"
+	    "  -i addr:file  also load file at addr (hex) into both cores, up to %d times\n"
+	    "  -n count      stop after this many instructions (default 10000000)\n"
+	    "  -b            run the cycle-exact bus core instead of the fast one\n"
+	    "  -k count      instructions of context to report (default 8, at most %d)\n"
+	    "  -j threads    worker threads (default: one per CPU)\n"
+	    "Documented NMOS opcodes only. Also stops when the program jumps or branches to itself.\n",
+	    MAX_INPUTS, MAX_CONTEXT);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char* colon;
+    int opt, i, failed = 0;
+
+    while((opt = getopt(argc, argv, "o:r:i:n:bk:j:")) != -1)
+	{
+	    switch(opt)
+		{
+		case 'o': org = addressarg(optarg, '\0'); break;
+		case 'r': resetvector = addressarg(optarg, '\0'); break;
+		case 'i':
+		    colon = strchr(optarg, ':');
+		    if(!colon || ninputs == MAX_INPUTS) usage();
+		    inputs[ninputs].address = addressarg(optarg, ':');
+		    inputs[ninputs].path = colon + 1;
+		    ninputs++;
+		    break;
+		case 'n': limit = strtoul(optarg, NULL, 10); break;
+		case 'b': bus = true; break;
+		case 'k': contextlen = atoi(optarg); break;
+		case 'j': threads = atoi(optarg); break;
+		default: usage();
+		}
+	}
+    if(optind >= argc) usage();
+    if(contextlen < 1) contextlen = 1;
+    if(contextlen > MAX_CONTEXT) contextlen = MAX_CONTEXT;
+
+    for(i = optind; i < argc; i++) addroms(argv[i], &(addrom));
+
+    if(threads < 1) threads = 1;
+    if(threads > count) threads = count;
+
+    runpool(threads, &(worker));
+
+    for(i = 0; i < count; i++)
+	{
+	    printjson(&(results[i]));
+	    if(strcmp(results[i].status, "diverged") == 0 || strcmp(results[i].status, "error") == 0) failed++;
+	}
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "6502.h"
+#include "events.h"
+
+static bool earlier(const struct EVENTS* q, int a, int b)
+{
+    const struct EVENT* x = &(q->events[a]);
+    const struct EVENT* y = &(q->events[b]);
+
+    return x->when < y->when || (x->when == y->when && x->order < y->order);
+}
+
+static void put(struct EVENTS* q, int pos, int handle)
+{
+    q->heap[pos] = handle;
+    q->events[handle].pos = pos;
+}
+
+static void siftup(struct EVENTS* q, int pos)
+{
+    int handle = q->heap[pos];
+
+    while(pos > 0 && earlier(q, handle, q->heap[(pos - 1) / 2]))
+	{
+	    put(q, pos, q->heap[(pos - 1) / 2]);
+	    pos = (pos - 1) / 2;
+	}
+    put(q, pos, handle);
+}
+
+static void siftdown(struct EVENTS* q, int pos)
+{
+    int handle = q->heap[pos];
+
+    for(;;)
+	{
+	    int child = 2 * pos + 1;
+
+	    if(child >= q->count) break;
+	    if(child + 1 < q->count && earlier(q, q->heap[child + 1], q->heap[child])) child++;
+	    if(!earlier(q, q->heap[child], handle)) break;
+	    put(q, pos, q->heap[child]);
+	    pos = child;
+	}
+    put(q, pos, handle);
+}
+
+static void unlink(struct EVENTS* q, int handle)
+{
+    int pos = q->events[handle].pos;
+    int last = q->heap[--q->count];
+
+    q->events[handle].pos = -1;
+    if(last == handle) return; //It was the last one in the heap
+
+    put(q, pos, last);
+    siftup(q, pos);
+    siftdown(q, q->events[last].pos);
+}
+
+//Something due now goes off after the next instruction, so an event that keeps putting itself at cycles can't hang run()
+static void refresh(const struct EVENTS* q)
+{
+    unsigned long when;
+
+    if(q->count == 0)
+	{
+	    nextevent = 0;
+	    return;
+	}
+
+    when = q->events[q->heap[0]].when;
+    nextevent = (when > cycles) ? when : cycles + 1;
+}
+
+void eventinit(struct EVENTS* q)
+{
+    q->events = NULL;
+    q->size = 0;
+    q->heap = NULL;
+    q->count = 0;
+    q->due = NULL;
+    q->order = 0;
+}
+
+void eventclose(struct EVENTS* q)
+{
+    free(q->events);
+    free(q->heap);
+    free(q->due);
+    eventinit(q);
+    nextevent = 0;
+}
+
+int eventnew(struct EVENTS* q, eventfunc fire, void* data)
+{
+    int handle;
+
+    for(handle = 0; handle < q->size; handle++) if(!q->events[handle].fire) break;
+
+    if(handle == q->size)
+	{
+	    int size = q->size ? 2 * q->size : 8;
+	    struct EVENT* events = realloc(q->events, size * sizeof(struct EVENT));
+	    int* heap;
+	    int* due;
+
+	    if(!events) return -1;
+	    q->events = events;
+	    heap = realloc(q->heap, size * sizeof(int));
+	    if(!heap) return -1;
+	    q->heap = heap;
+	    due = realloc(q->due, size * sizeof(int));
+	    if(!due) return -1;
+	    q->due = due;
+
+	    for(handle = q->size; handle < size; handle++) q->events[handle].fire = NULL;
+	    handle = q->size;
+	    q->size = size;
+	}
+
+    q->events[handle].when = 0;
+    q->events[handle].order = 0;
+    q->events[handle].fire = fire;
+    q->events[handle].data = data;
+    q->events[handle].pos = -1;
+
+    return handle;
+}
+
+void eventfree(struct EVENTS* q, int handle)
+{
+    eventcancel(q, handle);
+    q->events[handle].fire = NULL;
+}
+
+void eventschedule(struct EVENTS* q, int handle, unsigned long when)
+{
+    struct EVENT* e = &(q->events[handle]);
+
+    e->when = when;
+    e->order = q->order++;
+
+    if(e->pos < 0) //EVENT_DUE too: it goes back on the heap instead of firing now
+	{
+	    q->heap[q->count] = handle;
+	    e->pos = q->count++;
+	    siftup(q, e->pos);
+	}
+    else
+	{
+	    siftup(q, e->pos);
+	    siftdown(q, e->pos); //Only one of them moves it
+	}
+
+    refresh(q);
+}
+
+void eventcancel(struct EVENTS* q, int handle)
+{
+    if(q->events[handle].pos == EVENT_DUE) q->events[handle].pos = -1; //Off the heap already, so it just doesn't fire
+    if(q->events[handle].pos < 0) return;
+
+    unlink(q, handle);
+    refresh(q);
+}
+
+bool eventpending(const struct EVENTS* q, int handle)
+{
+    return q->events[handle].pos != -1;
+}
+
+void eventdispatch(struct EVENTS* q)
+{
+    int due = 0;
+    int i;
+
+    //Take everything due off the heap first, so anything scheduled from here on waits for the next dispatch
+    while(q->count && q->events[q->heap[0]].when <= cycles)
+	{
+	    int handle = q->heap[0];
+
+	    unlink(q, handle);
+	    q->events[handle].pos = EVENT_DUE;
+	    q->due[due++] = handle;
+	}
+
+    for(i = 0; i < due; i++)
+	{
+	    int handle = q->due[i];
+	    struct EVENT* e = &(q->events[handle]);
+
+	    if(e->pos != EVENT_DUE) continue; //An earlier one cancelled or moved it
+	    e->pos = -1;
+	    e->fire(q, handle, e->data); //Can schedule, cancel or free anything, this one included
+	}
+
+    refresh(q);
+}
+
+unsigned long eventrun(struct EVENTS* q, unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    eventdispatch(q);
+    while(cycles < end)
+	{
+	    run(end - cycles); //Stops at nextevent, which is the earliest deadline
+	    eventdispatch(q);
+	}
+
+    return cycles - begin;
+}
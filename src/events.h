@@ -0,0 +1,78 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+
+#include "6502.h"
+
+#ifndef EVENTS_H_INCLUDED
+#define EVENTS_H_INCLUDED
+
+/*
+ * Device events at a cycle: timers, raster lines, a serial shifter's next bit. Each event gets a handle once and
+ * is then scheduled, moved or cancelled as often as the device needs, in O(log n) on a binary heap. The queue
+ * keeps nextevent on its earliest deadline, so run() (And everything built on it) goes straight through to that
+ * cycle without the host checking after every instruction. An event fires at the first instruction boundary at
+ * or after its cycle, from eventdispatch(); it can raise an interrupt() and schedule itself, or anything else.
+ * Events due on the same cycle fire in the order they were scheduled.
+ *
+ * One queue per CPU, used on the thread that runs that CPU, since nextevent belongs to it
+ */
+
+struct EVENTS;
+typedef void (*eventfunc)(struct EVENTS* q, int handle, void* data);
+
+struct EVENT
+{
+    unsigned long when; //Cycle it's due at
+    unsigned long order; //Ties on the same cycle go first come, first served
+    eventfunc fire; //NULL for a free handle
+    void* data;
+    int pos; //Index in heap, -1 while not scheduled, EVENT_DUE while eventdispatch() is about to fire it
+};
+
+#define EVENT_DUE -2
+
+struct EVENTS
+{
+    struct EVENT* events; //Indexed by handle
+    int size; //Handles allocated
+    int* heap; //Handles, earliest first
+    int count; //Events scheduled
+    int* due; //Handles eventdispatch() took off the heap to fire, in order
+    unsigned long order;
+};
+
+void eventinit(struct EVENTS* q);
+void eventclose(struct EVENTS* q); //Frees it all and clears nextevent
+
+int eventnew(struct EVENTS* q, eventfunc fire, void* data); //A handle, not scheduled yet. -1 if out of memory
+void eventfree(struct EVENTS* q, int handle); //Cancels it too. The handle can be given out again
+void eventschedule(struct EVENTS* q, int handle, unsigned long when); //Schedules it, or moves it if it already is
+void eventcancel(struct EVENTS* q, int handle); //Nothing if it isn't scheduled
+bool eventpending(const struct EVENTS* q, int handle);
+
+void eventdispatch(struct EVENTS* q); //Fires everything due by now, then points nextevent at the next one. Not from an event
+unsigned long eventrun(struct EVENTS* q, unsigned long n); //Like run(n), firing events on time along the way
+
+#endif // EVENTS_H_INCLUDED
@@ -0,0 +1,179 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+/*
+ * libFuzzer front end. Loads a ROM once, then for every input:
+ *   - puts the input in memory (FREE6502_INPUT) or behind an I/O port (FREE6502_PORT)
+ *   - runs from the reset vector for FREE6502_CYCLES cycles
+ *   - puts back the pages it wrote, the way they were after loading the ROM
+ * Edge coverage of the 6502 program goes into libFuzzer's extra counters.
+ *
+ * Build: clang -O2 -fsanitize=fuzzer -DCOVERAGE fuzz.c 6502.c buscore.c -o fuzz6502
+ *
+ * Environment:
+ *   FREE6502_ROM - ROM image (Required)
+ *   FREE6502_ORG - Load address of the ROM (Hex, defaults to the top of memory)
+ *   FREE6502_INPUT - addr:maxlen (Hex) Input is copied to addr, its length is the word just below it
+ *   FREE6502_PORT - addr (Hex) Every read returns the next input byte, then 0 once it runs out
+ *   FREE6502_CYCLES - Cycles per input (Decimal, defaults to 1000000)
+ *   FREE6502_VARIANT - One of the CPU_* numbers (Defaults to CPU_NMOS)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "6502.h"
+
+#ifndef COVERAGE
+#error "fuzz.c needs -DCOVERAGE"
+#endif
+
+byte coverage[COVERAGE_SIZE] __attribute__((section("__libfuzzer_extra_counters")));
+
+static byte mem[0x10000]; //Flat memory, mapped page by page into memorymap
+static byte image[0x10000]; //Memory as it was right after the ROM was loaded
+
+static unsigned long inputaddr, inputmax;
+static unsigned long port;
+static unsigned long budget = 1000000;
+
+static const uint8_t* data; //The current input
+static size_t size, pos;
+
+static byte portread(word address)
+{
+    if(BIG(address) == port) return (pos < size) ? data[pos++] : 0;
+
+    return getpage(address)[LOWBYTE(address)];
+}
+
+static void portwrite(word address, byte b)
+{
+    writepage(address)[LOWBYTE(address)] = b;
+}
+
+static unsigned long envhex(const char* name, unsigned long def)
+{
+    const char* s = getenv(name);
+
+    return s ? strtoul(s, NULL, 16) : def;
+}
+
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    const char* rom = getenv("FREE6502_ROM");
+    const char* s;
+    FILE* f;
+    long len;
+    unsigned long org;
+    int i;
+
+    if(!rom || !(f = fopen(rom, "rb")))
+	{
+	    fprintf(stderr, "fuzz6502: set FREE6502_ROM to a ROM image\n");
+	    exit(1);
+	}
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(len <= 0 || len > 0x10000)
+	{
+	    fprintf(stderr, "fuzz6502: %s isn't a 6502 ROM\n", rom);
+	    exit(1);
+	}
+
+    org = envhex("FREE6502_ORG", 0x10000 - len);
+    if(org + len > 0x10000 || fread(mem + org, 1, len, f) != (size_t) len)
+	{
+	    fprintf(stderr, "fuzz6502: can't load %s at %lx\n", rom, org);
+	    exit(1);
+	}
+    fclose(f);
+
+    memorymap.zero = mem;
+    memorymap.stack = mem + 0x100;
+    for(i = 0; i < 254; i++) memorymap.pages[i] = mem + 0x200 + 0x100 * i;
+
+    s = getenv("FREE6502_INPUT");
+    if(s && (sscanf(s, "%lx:%lx", &inputaddr, &inputmax) != 2 || inputaddr + inputmax > 0x10000))
+	{
+	    fprintf(stderr, "fuzz6502: FREE6502_INPUT %s doesn't fit in memory\n", s);
+	    exit(1);
+	}
+    if((s = getenv("FREE6502_CYCLES"))) budget = strtoul(s, NULL, 10);
+    if((s = getenv("FREE6502_VARIANT"))) setvariant(atoi(s));
+
+    port = envhex("FREE6502_PORT", 0);
+    if(port > 0xffff)
+	{
+	    fprintf(stderr, "fuzz6502: FREE6502_PORT %lx isn't an address\n", port);
+	    exit(1);
+	}
+    if(port)
+	{
+	    pageflags[port >> 8] |= PAGE_IO;
+	    ioread = &(portread);
+	    iowrite = &(portwrite);
+	}
+
+    memcpy(image, mem, sizeof(image));
+
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* d, size_t s)
+{
+    int i;
+
+    data = d;
+    size = s;
+    pos = 0;
+
+    if(inputmax)
+	{
+	    size_t n = (s < inputmax) ? s : inputmax;
+
+	    memcpy(mem + inputaddr, d, n);
+	    mem[(inputaddr - 2) & 0xffff] = n & 0xff;
+	    mem[(inputaddr - 1) & 0xffff] = n >> 8;
+	    for(i = -2; i < (int) n; i++) dirty[((inputaddr + i) >> 8) & 0xff] = 1; //So they get restored with the rest
+	}
+
+    cycles = 0;
+    nextevent = 0;
+    registers.p = BtoP(0x24); //Interrupts off, like after power on
+    reset();
+    run(budget);
+
+    for(i = 0; i < 0x100; i++) //Most inputs only touch a few pages
+	{
+	    if(dirty[i]) memcpy(mem + 0x100 * i, image + 0x100 * i, 0x100);
+	}
+    memset(dirty, 0, sizeof(dirty));
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "6502.h"
+#include "pace.h"
+
+#define NS 1000000000L
+
+static const unsigned long limits[PACE_BUCKETS - 1] = { 10000, 50000, 100000, 500000, 1000000 };
+
+static long long since(const struct timespec* a, const struct timespec* b) //b - a, in nanoseconds
+{
+    return (long long) (b->tv_sec - a->tv_sec) * NS + (b->tv_nsec - a->tv_nsec);
+}
+
+static struct timespec due(const struct PACE* p, unsigned long c) //When cycle c should be reached
+{
+    unsigned long elapsed = c - p->origincycles;
+    struct timespec t = p->origin;
+    unsigned long long ns = (unsigned long long) (elapsed % p->hz) * NS / p->hz; //Split so it can't overflow
+
+    t.tv_sec += elapsed / p->hz;
+    t.tv_nsec += ns;
+    if(t.tv_nsec >= NS)
+	{
+	    t.tv_sec++;
+	    t.tv_nsec -= NS;
+	}
+
+    return t;
+}
+
+static void sleepuntil(const struct PACE* p, const struct timespec* deadline)
+{
+    struct timespec now;
+    struct timespec wake = *deadline;
+
+    if(p->spin)
+	{
+	    wake.tv_nsec -= p->spin % NS;
+	    wake.tv_sec -= p->spin / NS;
+	    if(wake.tv_nsec < 0)
+		{
+		    wake.tv_sec--;
+		    wake.tv_nsec += NS;
+		}
+	}
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+
+    if(!p->spin) return;
+    do clock_gettime(CLOCK_MONOTONIC, &now); while(since(deadline, &now) < 0);
+}
+
+void paceinit(struct PACE* p, unsigned long hz, unsigned long slice)
+{
+    memset(p, 0, sizeof(struct PACE));
+    p->hz = hz ? hz : 1;
+    p->slice = slice ? slice : (p->hz / 1000 ? p->hz / 1000 : 1);
+    p->maxlag = NS / 10;
+    p->run = &(run);
+
+#ifdef __linux__
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0); //The default 50 µs of slack would be most of the jitter budget
+#endif
+
+    pacereset(p);
+}
+
+void pacereset(struct PACE* p)
+{
+    clock_gettime(CLOCK_MONOTONIC, &(p->origin));
+    p->origincycles = cycles;
+}
+
+unsigned long pacerun(struct PACE* p, unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    while(cycles < end)
+	{
+	    struct timespec deadline, now;
+	    unsigned long ran = p->run((end - cycles < p->slice) ? end - cycles : p->slice);
+	    long long late;
+	    int i;
+
+	    if(!ran) break; //At nextevent
+
+	    deadline = due(p, cycles);
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    late = since(&deadline, &now);
+
+	    if(late > (long long) p->maxlag)
+		{
+		    p->origin = now; //Too far behind to be worth catching up
+		    p->origincycles = cycles;
+		    p->resyncs++;
+		    continue;
+		}
+	    if(late >= 0)
+		{
+		    p->behind++; //Run the next slice straight away to catch up
+		    continue;
+		}
+
+	    sleepuntil(p, &deadline);
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    late = since(&deadline, &now);
+	    if(late < 0) late = 0;
+
+	    p->slices++;
+	    p->jittersum += late;
+	    p->jittersquares += (double) late * late;
+	    if((unsigned long) late > p->maxjitter) p->maxjitter = late;
+	    for(i = 0; i < PACE_BUCKETS - 1 && (unsigned long) late >= limits[i]; i++);
+	    p->buckets[i]++;
+	}
+
+    return cycles - begin;
+}
+
+void pacereport(const struct PACE* p, FILE* f)
+{
+    double mean = p->slices ? p->jittersum / p->slices : 0;
+    double variance = p->slices ? p->jittersquares / p->slices - mean * mean : 0;
+    int i;
+
+    fprintf(f, "{\"hz\":%lu,\"slice\":%lu,\"slices\":%lu,\"behind\":%lu,\"resyncs\":%lu,", p->hz, p->slice,
+	    p->slices, p->behind, p->resyncs);
+    fprintf(f, "\"jitter_ns\":{\"mean\":%.0f,\"stddev\":%.0f,\"max\":%lu,\"histogram_us\":{", mean,
+	    (variance > 0) ? sqrt(variance) : 0.0, p->maxjitter);
+    for(i = 0; i < PACE_BUCKETS; i++)
+	{
+	    if(i < PACE_BUCKETS - 1) fprintf(f, "%s\"<%lu\":%lu", i ? "," : "", limits[i] / 1000, p->buckets[i]);
+	    else fprintf(f, ",\"more\":%lu", p->buckets[i]);
+	}
+    fprintf(f, "}}}\n");
+}
@@ -0,0 +1,72 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "6502.h"
+
+#ifndef PACE_H_INCLUDED
+#define PACE_H_INCLUDED
+
+/*
+ * Real-time pacing. The CPU runs in slices, and after each one the thread sleeps until the wall clock time that
+ * cycle is due at, for the chosen clock rate. Deadlines are counted from one origin, so rounding never adds up
+ * to drift; after a hiccup the slices run back to back until they've caught up. A hiccup longer than maxlag
+ * (The host was suspended, a debugger stopped it) moves the origin instead of racing to make it all up.
+ *
+ * The sleep is clock_nanosleep() to an absolute time with the timer slack turned down, and can end with a short
+ * spin for rigs that need tighter wake ups than the scheduler gives. Jitter is how late each wake up was
+ */
+
+#define PACE_BUCKETS 6 //Jitter histogram: under 10, 50, 100, 500 and 1000 µs, and the rest
+
+struct PACE
+{
+    unsigned long hz; //Emulated clock rate
+    unsigned long slice; //Cycles per slice
+    unsigned long spin; //Nanoseconds before each deadline to stop sleeping and spin instead (0 to never spin)
+    unsigned long maxlag; //Nanoseconds behind before giving up on catching up
+    unsigned long (*run)(unsigned long n); //run(), or the host's own wrapper around it
+
+    struct timespec origin; //When origincycles was due
+    unsigned long origincycles;
+
+    //Statistics
+    unsigned long slices; //Slices that slept
+    unsigned long behind; //Slices that were already late, so didn't sleep
+    unsigned long resyncs; //Times the origin was moved
+    unsigned long maxjitter; //Nanoseconds
+    double jittersum;
+    double jittersquares;
+    unsigned long buckets[PACE_BUCKETS];
+};
+
+void paceinit(struct PACE* p, unsigned long hz, unsigned long slice); //slice 0 for a millisecond's worth. Starts the clock now
+void pacereset(struct PACE* p); //Starts the clock again from now, after the host paused on purpose
+
+unsigned long pacerun(struct PACE* p, unsigned long n); //Like run(n), in real time. Stops early at nextevent
+void pacereport(const struct PACE* p, FILE* f); //One JSON object
+
+#endif // PACE_H_INCLUDED
@@ -0,0 +1,225 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "6502.h"
+#include "perfstats.h"
+
+#ifndef STATS
+#error "perfstats.c needs -DSTATS"
+#endif
+
+#define CLASS(name, mode, kind, reg, c, l, t) [c] = CLASS_##kind,
+const byte opclass[3][256] = {
+    [CPU_NMOS] = { OPCODES(CLASS) },
+    [CPU_NMOSX] = { OPCODES(CLASS) ILLEGAL_OPCODES(CLASS) },
+    [CPU_65C02] = { OPCODES(CLASS) CMOS_OPCODES(CLASS) } }; //Later entries win, as in the dispatch tables
+#undef CLASS
+
+static const char* classnames[OPCLASSES] = { "alu", "load", "compare", "test", "modify", "store", "write", "skip", "branch", "jump", "implied" };
+static const char* hostnames[PERF_COUNTERS] = { "cycles", "instructions", "branch_misses", "l1d_misses" };
+
+static int classify(byte code)
+{
+    bool cmos = (variant == CPU_65C02);
+
+    if(!optable[code].op) return CLASS_IMPLIED; //Not in the table, so next() runs it as a NOP
+    if(opclass[variant][code] != CLASS_IMPLIED) return opclass[variant][code];
+    if((code & 0x1f) == 0x10 || (cmos && (code == 0x80 || (code & 0x0f) == 0x0f))) return CLASS_BRANCH; //65C02 adds BRA, BBR and BBS
+
+    switch(code)
+	{
+	case 0x00: case 0x20: case 0x40: case 0x4c: case 0x60: case 0x6c:
+	    return CLASS_JUMP;
+	case 0x7c: //JMP (abs,X)
+	    return cmos ? CLASS_JUMP : CLASS_IMPLIED;
+	}
+
+    return CLASS_IMPLIED;
+}
+
+static int openevent(uint32_t type, uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group == -1); //The leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void readall(const struct PERFSTATS* s, unsigned long* values)
+{
+    int i;
+
+    for(i = 0; i < PERF_COUNTERS; i++)
+	{
+	    uint64_t v = 0;
+
+	    if(s->fd[i] >= 0 && read(s->fd[i], &v, sizeof(v)) != sizeof(v)) v = 0;
+	    values[i] = v;
+	}
+}
+
+bool perfopen(struct PERFSTATS* s)
+{
+    unsigned long before[PERF_COUNTERS], after[PERF_COUNTERS];
+    int i;
+
+    memset(s, 0, sizeof(struct PERFSTATS));
+    s->fd[PERF_CYCLES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(s->fd[PERF_CYCLES] < 0)
+	{
+	    for(i = 0; i < PERF_COUNTERS; i++) s->fd[i] = -1;
+	    return false;
+	}
+
+    s->fd[PERF_INSTRUCTIONS] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, s->fd[PERF_CYCLES]);
+    s->fd[PERF_BRANCHMISSES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, s->fd[PERF_CYCLES]);
+    s->fd[PERF_L1DMISSES] = openevent(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), s->fd[PERF_CYCLES]);
+
+    s->start = stats;
+
+    //Measure what a pair of reads costs, so split measurements can leave it out
+    ioctl(s->fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    readall(s, before);
+    readall(s, after);
+    ioctl(s->fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for(i = 0; i < PERF_COUNTERS; i++) s->overhead[i] = after[i] - before[i];
+
+    return true;
+}
+
+void perfclose(struct PERFSTATS* s)
+{
+    int i;
+
+    for(i = 0; i < PERF_COUNTERS; i++)
+	{
+	    if(s->fd[i] >= 0) close(s->fd[i]);
+	    s->fd[i] = -1;
+	}
+}
+
+unsigned long perfrun(struct PERFSTATS* s, unsigned long n, bool byclass)
+{
+    unsigned long before[PERF_COUNTERS], after[PERF_COUNTERS];
+    unsigned long begin = cycles;
+    int i;
+
+    if(s->fd[PERF_CYCLES] < 0)
+	{
+	    run(n);
+	    s->cycles += cycles - begin;
+	    return cycles - begin;
+	}
+
+    ioctl(s->fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    readall(s, before);
+
+    if(byclass)
+	{
+	    unsigned long end = cycles + n;
+
+	    s->split = true;
+	    if(nextevent && nextevent < end) end = nextevent;
+	    while(cycles < end)
+		{
+		    unsigned long a[PERF_COUNTERS], b[PERF_COUNTERS];
+		    int class = classify(readb(registers.pc));
+
+		    readall(s, a);
+		    if(busexact) nextbus(); //The core run() would have used
+		    else next();
+		    readall(s, b);
+		    if(nextevent && nextevent < end) end = nextevent;
+
+		    for(i = 0; i < PERF_COUNTERS; i++)
+			{
+			    unsigned long used = b[i] - a[i];
+
+			    s->classhost[class][i] += (used > s->overhead[i]) ? used - s->overhead[i] : 0;
+			}
+		}
+	}
+    else run(n);
+
+    readall(s, after);
+    ioctl(s->fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for(i = 0; i < PERF_COUNTERS; i++) s->host[i] += after[i] - before[i];
+    s->cycles += cycles - begin;
+
+    return cycles - begin;
+}
+
+void perfreport(const struct PERFSTATS* s, FILE* f)
+{
+    unsigned long retired = stats.retired - s->start.retired;
+    unsigned long classcount[OPCLASSES] = { 0 };
+    int i, j;
+
+    for(i = 0; i < 256; i++) classcount[classify(i)] += stats.opcodes[i] - s->start.opcodes[i];
+
+    fprintf(f, "{\"emulator\":{\"retired\":%lu,\"cycles\":%lu,\"idle_cycles\":%lu,\"interrupts\":%lu,\"io_accesses\":%lu},",
+	    retired, s->cycles, stats.idlecycles - s->start.idlecycles, stats.interrupts - s->start.interrupts,
+	    stats.ioaccesses - s->start.ioaccesses);
+
+    fprintf(f, "\"host\":{");
+    for(i = 0; i < PERF_COUNTERS; i++)
+	{
+	    fprintf(f, "%s\"%s\":", i ? "," : "", hostnames[i]);
+	    if(s->fd[i] < 0) fprintf(f, "null");
+	    else fprintf(f, "{\"total\":%lu,\"per_instruction\":%.3f}", s->host[i], retired ? (double) s->host[i] / retired : 0.0);
+	}
+    fprintf(f, "},");
+
+    fprintf(f, "\"classes\":{");
+    for(i = 0; i < OPCLASSES; i++)
+	{
+	    fprintf(f, "%s\"%s\":{\"retired\":%lu", i ? "," : "", classnames[i], classcount[i]);
+	    for(j = 0; j < PERF_COUNTERS && s->split; j++) //Counts the host's side was never split into would all read 0
+		{
+		    if(s->fd[j] < 0) continue;
+		    fprintf(f, ",\"%s_per_instruction\":%.3f", hostnames[j],
+			    classcount[i] ? (double) s->classhost[i][j] / classcount[i] : 0.0);
+		}
+	    fprintf(f, "}");
+	}
+    fprintf(f, "}}\n");
+}
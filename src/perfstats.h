@@ -0,0 +1,83 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "6502.h"
+
+#ifndef PERFSTATS_H_INCLUDED
+#define PERFSTATS_H_INCLUDED
+
+/*
+ * Host hardware counters (Linux perf_event) around batches of emulation, next to the emulator's own counters.
+ * Everything is for the calling thread's CPU. Needs a -DSTATS build
+ */
+
+//Host counters
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_BRANCHMISSES 2
+#define PERF_L1DMISSES 3
+#define PERF_COUNTERS 4
+
+//Opcode classes. The first ones are the handler kinds from OPCODES, IMPLIED is split into the rest
+#define CLASS_ALU 0
+#define CLASS_LOAD 1
+#define CLASS_COMPARE 2
+#define CLASS_TEST 3
+#define CLASS_MODIFY 4
+#define CLASS_STORE 5
+#define CLASS_WRITE 6
+#define CLASS_SKIP 7
+#define CLASS_BRANCH 8
+#define CLASS_JUMP 9 //JMP, JSR, RTS, RTI, BRK
+#define CLASS_IMPLIED 10 //Everything else
+#define OPCLASSES 11
+
+struct PERFSTATS
+{
+    int fd[PERF_COUNTERS]; //-1 for counters this host doesn't have
+    unsigned long host[PERF_COUNTERS]; //Totals over every perfrun()
+    unsigned long classhost[OPCLASSES][PERF_COUNTERS]; //Only filled in when perfrun() is asked to split by class
+    unsigned long overhead[PERF_COUNTERS]; //What reading the counters costs, taken off every split measurement
+
+    struct CPUSTATS start; //The emulator's counters when perfopen() was called
+    unsigned long cycles; //Emulated cycles run through perfrun()
+    bool split; //A perfrun() split by class, so classhost means something
+};
+
+extern const byte opclass[3][256]; //CLASS_* for each opcode, by variant (CPU_*)
+
+bool perfopen(struct PERFSTATS* s); //False if the host has no usable counters (Not Linux, or perf_event_paranoid)
+void perfclose(struct PERFSTATS* s);
+
+/*
+ * run(n) with the counters on. With byclass it steps one instruction at a time and charges the host counters
+ * to each instruction's class instead, which is far slower, so leave it for profiling runs
+ */
+unsigned long perfrun(struct PERFSTATS* s, unsigned long n, bool byclass);
+
+void perfreport(const struct PERFSTATS* s, FILE* f); //One JSON object: totals, per emulated instruction and per class
+
+#endif // PERFSTATS_H_INCLUDED
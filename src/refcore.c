@@ -0,0 +1,382 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "refcore.h"
+
+enum { ___, ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC, CLD, CLI, CLV, CMP, CPX, CPY,
+       DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR,
+       RTI, RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA };
+
+enum { imp, acc, imm, zp, zpx, zpy, ab, abx, aby, ind, izx, izy, rel };
+
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_I 0x04
+#define FLAG_D 0x08
+#define FLAG_B 0x10
+#define FLAG_V 0x40
+#define FLAG_N 0x80
+
+//The opcode matrix, row by row: instruction, addressing mode and base cycles
+static const uint8_t ops[256] = {
+    BRK, ORA, ___, ___, ___, ORA, ASL, ___, PHP, ORA, ASL, ___, ___, ORA, ASL, ___,
+    BPL, ORA, ___, ___, ___, ORA, ASL, ___, CLC, ORA, ___, ___, ___, ORA, ASL, ___,
+    JSR, AND, ___, ___, BIT, AND, ROL, ___, PLP, AND, ROL, ___, BIT, AND, ROL, ___,
+    BMI, AND, ___, ___, ___, AND, ROL, ___, SEC, AND, ___, ___, ___, AND, ROL, ___,
+    RTI, EOR, ___, ___, ___, EOR, LSR, ___, PHA, EOR, LSR, ___, JMP, EOR, LSR, ___,
+    BVC, EOR, ___, ___, ___, EOR, LSR, ___, CLI, EOR, ___, ___, ___, EOR, LSR, ___,
+    RTS, ADC, ___, ___, ___, ADC, ROR, ___, PLA, ADC, ROR, ___, JMP, ADC, ROR, ___,
+    BVS, ADC, ___, ___, ___, ADC, ROR, ___, SEI, ADC, ___, ___, ___, ADC, ROR, ___,
+    ___, STA, ___, ___, STY, STA, STX, ___, DEY, ___, TXA, ___, STY, STA, STX, ___,
+    BCC, STA, ___, ___, STY, STA, STX, ___, TYA, STA, TXS, ___, ___, STA, ___, ___,
+    LDY, LDA, LDX, ___, LDY, LDA, LDX, ___, TAY, LDA, TAX, ___, LDY, LDA, LDX, ___,
+    BCS, LDA, ___, ___, LDY, LDA, LDX, ___, CLV, LDA, TSX, ___, LDY, LDA, LDX, ___,
+    CPY, CMP, ___, ___, CPY, CMP, DEC, ___, INY, CMP, DEX, ___, CPY, CMP, DEC, ___,
+    BNE, CMP, ___, ___, ___, CMP, DEC, ___, CLD, CMP, ___, ___, ___, CMP, DEC, ___,
+    CPX, SBC, ___, ___, CPX, SBC, INC, ___, INX, SBC, NOP, ___, CPX, SBC, INC, ___,
+    BEQ, SBC, ___, ___, ___, SBC, INC, ___, SED, SBC, ___, ___, ___, SBC, INC, ___ };
+
+static const uint8_t modes[256] = {
+    imp, izx, imp, imp, imp, zp,  zp,  imp, imp, imm, acc, imp, imp, ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp,
+    ab,  izx, imp, imp, zp,  zp,  zp,  imp, imp, imm, acc, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp,
+    imp, izx, imp, imp, imp, zp,  zp,  imp, imp, imm, acc, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp,
+    imp, izx, imp, imp, imp, zp,  zp,  imp, imp, imm, acc, imp, ind, ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp,
+    imp, izx, imp, imp, zp,  zp,  zp,  imp, imp, imp, imp, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, zpx, zpx, zpy, imp, imp, aby, imp, imp, imp, abx, imp, imp,
+    imm, izx, imm, imp, zp,  zp,  zp,  imp, imp, imm, imp, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, zpx, zpx, zpy, imp, imp, aby, imp, imp, abx, abx, aby, imp,
+    imm, izx, imp, imp, zp,  zp,  zp,  imp, imp, imm, imp, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp,
+    imm, izx, imp, imp, zp,  zp,  zp,  imp, imp, imm, imp, imp, ab,  ab,  ab,  imp,
+    rel, izy, imp, imp, imp, zpx, zpx, imp, imp, aby, imp, imp, imp, abx, abx, imp };
+
+static const uint8_t times[256] = {
+    7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,
+    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
+    2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0 };
+
+static uint8_t read8(struct REFCPU* r, uint16_t address)
+{
+    return r->mem[address];
+}
+
+static uint16_t read16(struct REFCPU* r, uint16_t address)
+{
+    return r->mem[address] | (r->mem[(uint16_t) (address + 1)] << 8);
+}
+
+static void write8(struct REFCPU* r, uint16_t address, uint8_t value)
+{
+    r->mem[address] = value;
+    if(r->nwrites < REF_WRITES) r->writes[r->nwrites++] = address;
+}
+
+static void push(struct REFCPU* r, uint8_t value)
+{
+    write8(r, 0x100 + r->s, value);
+    r->s--;
+}
+
+static uint8_t pull(struct REFCPU* r)
+{
+    r->s++;
+    return read8(r, 0x100 + r->s);
+}
+
+static void setflag(struct REFCPU* r, uint8_t flag, bool on)
+{
+    if(on) r->p |= flag;
+    else r->p &= ~flag;
+}
+
+static void setnz(struct REFCPU* r, uint8_t value)
+{
+    setflag(r, FLAG_Z, value == 0);
+    setflag(r, FLAG_N, value & 0x80);
+}
+
+static void compare(struct REFCPU* r, uint8_t reg, uint8_t value)
+{
+    setflag(r, FLAG_C, reg >= value);
+    setnz(r, reg - value);
+}
+
+//Decimal mode as the NMOS chip does it, valid BCD or not: Z from the binary sum, N and V from the half-adjusted one
+static void adc(struct REFCPU* r, uint8_t value)
+{
+    int carry = r->p & FLAG_C;
+    int sum = r->a + value + carry;
+
+    if(r->p & FLAG_D)
+	{
+	    int low = (r->a & 0x0f) + (value & 0x0f) + carry;
+	    int result;
+	    int half;
+
+	    if(low >= 0x0a) low = ((low + 0x06) & 0x0f) + 0x10;
+	    result = (r->a & 0xf0) + (value & 0xf0) + low;
+	    half = (int8_t) (r->a & 0xf0) + (int8_t) (value & 0xf0) + low; //Signed, for N and V
+
+	    setflag(r, FLAG_Z, (sum & 0xff) == 0);
+	    setflag(r, FLAG_N, half & 0x80);
+	    setflag(r, FLAG_V, half < -128 || half > 127);
+	    if(result >= 0xa0) result += 0x60;
+	    setflag(r, FLAG_C, result >= 0x100);
+	    r->a = result & 0xff;
+	    return;
+	}
+
+    setflag(r, FLAG_V, ~(r->a ^ value) & (r->a ^ sum) & 0x80);
+    setflag(r, FLAG_C, sum > 0xff);
+    r->a = sum & 0xff;
+    setnz(r, r->a);
+}
+
+static void sbc(struct REFCPU* r, uint8_t value)
+{
+    int borrow = !(r->p & FLAG_C);
+    int diff = r->a - value - borrow;
+
+    setflag(r, FLAG_V, (r->a ^ value) & (r->a ^ diff) & 0x80);
+    setflag(r, FLAG_C, diff >= 0);
+    setnz(r, diff & 0xff); //Every flag from the binary difference, decimal or not
+
+    if(r->p & FLAG_D)
+	{
+	    int low = (r->a & 0x0f) - (value & 0x0f) - borrow;
+	    int result;
+
+	    if(low < 0) low = ((low - 0x06) & 0x0f) - 0x10;
+	    result = (r->a & 0xf0) - (value & 0xf0) + low;
+	    if(result < 0) result -= 0x60;
+	    diff = result;
+	}
+
+    r->a = diff & 0xff;
+}
+
+static uint8_t shift(struct REFCPU* r, int op, uint8_t value)
+{
+    int carry = r->p & FLAG_C;
+
+    switch(op)
+	{
+	case ASL: setflag(r, FLAG_C, value & 0x80); value <<= 1; break;
+	case LSR: setflag(r, FLAG_C, value & 0x01); value >>= 1; break;
+	case ROL: setflag(r, FLAG_C, value & 0x80); value = (value << 1) | carry; break;
+	case ROR: setflag(r, FLAG_C, value & 0x01); value = (value >> 1) | (carry << 7); break;
+	case INC: value++; break;
+	case DEC: value--; break;
+	}
+
+    setnz(r, value);
+    return value;
+}
+
+void refreset(struct REFCPU* r)
+{
+    r->a = 0;
+    r->x = 0;
+    r->y = 0;
+    r->s = 0xfd;
+    r->p = 0x24;
+    r->pc = read16(r, 0xfffc);
+    r->cycles = 0;
+    r->nwrites = 0;
+}
+
+bool refstep(struct REFCPU* r)
+{
+    uint8_t code = read8(r, r->pc);
+    int op = ops[code];
+    int mode = modes[code];
+    uint16_t at = r->pc + 1; //Operand bytes
+    uint16_t address = 0;
+    uint16_t base;
+    bool crossed = false;
+    uint8_t value = 0;
+
+    if(op == ___) return false;
+
+    r->nwrites = 0;
+    r->cycles += times[code];
+
+    switch(mode)
+	{
+	case imp: case acc: r->pc += 1; break;
+	case imm: address = at; r->pc += 2; break;
+	case zp: address = read8(r, at); r->pc += 2; break;
+	case zpx: address = (uint8_t) (read8(r, at) + r->x); r->pc += 2; break;
+	case zpy: address = (uint8_t) (read8(r, at) + r->y); r->pc += 2; break;
+	case rel: address = r->pc + 2 + (int8_t) read8(r, at); r->pc += 2; break;
+	case ab: address = read16(r, at); r->pc += 3; break;
+	case abx: base = read16(r, at); address = base + r->x; crossed = (base ^ address) & 0xff00; r->pc += 3; break;
+	case aby: base = read16(r, at); address = base + r->y; crossed = (base ^ address) & 0xff00; r->pc += 3; break;
+	case ind: //The pointer's high byte comes from the same page, a famous NMOS bug
+	    base = read16(r, at);
+	    address = read8(r, base) | (read8(r, (base & 0xff00) | (uint8_t) (base + 1)) << 8);
+	    r->pc += 3;
+	    break;
+	case izx:
+	    base = (uint8_t) (read8(r, at) + r->x);
+	    address = read8(r, base) | (read8(r, (uint8_t) (base + 1)) << 8);
+	    r->pc += 2;
+	    break;
+	case izy:
+	    base = read8(r, at);
+	    base = read8(r, base) | (read8(r, (uint8_t) (base + 1)) << 8);
+	    address = base + r->y;
+	    crossed = (base ^ address) & 0xff00;
+	    r->pc += 2;
+	    break;
+	}
+
+    //Reads pay for crossing a page, stores and read-modify-write always take the extra cycle (Counted in times[])
+    if(crossed && op != STA && op != ASL && op != LSR && op != ROL && op != ROR && op != INC && op != DEC) r->cycles++;
+    if(mode != imp && mode != acc && mode != rel && op != JMP && op != JSR && op != STA && op != STX && op != STY)
+	value = read8(r, address);
+
+    switch(op)
+	{
+	case ADC: adc(r, value); break;
+	case SBC: sbc(r, value); break;
+	case AND: r->a &= value; setnz(r, r->a); break;
+	case ORA: r->a |= value; setnz(r, r->a); break;
+	case EOR: r->a ^= value; setnz(r, r->a); break;
+	case BIT:
+	    setflag(r, FLAG_Z, (r->a & value) == 0);
+	    setflag(r, FLAG_N, value & 0x80);
+	    setflag(r, FLAG_V, value & 0x40);
+	    break;
+	case CMP: compare(r, r->a, value); break;
+	case CPX: compare(r, r->x, value); break;
+	case CPY: compare(r, r->y, value); break;
+
+	case ASL: case LSR: case ROL: case ROR: case INC: case DEC:
+	    if(mode == acc) r->a = shift(r, op, r->a);
+	    else write8(r, address, shift(r, op, value));
+	    break;
+
+	case LDA: r->a = value; setnz(r, value); break;
+	case LDX: r->x = value; setnz(r, value); break;
+	case LDY: r->y = value; setnz(r, value); break;
+	case STA: write8(r, address, r->a); break;
+	case STX: write8(r, address, r->x); break;
+	case STY: write8(r, address, r->y); break;
+
+	case TAX: r->x = r->a; setnz(r, r->x); break;
+	case TAY: r->y = r->a; setnz(r, r->y); break;
+	case TXA: r->a = r->x; setnz(r, r->a); break;
+	case TYA: r->a = r->y; setnz(r, r->a); break;
+	case TSX: r->x = r->s; setnz(r, r->x); break;
+	case TXS: r->s = r->x; break;
+	case INX: r->x++; setnz(r, r->x); break;
+	case INY: r->y++; setnz(r, r->y); break;
+	case DEX: r->x--; setnz(r, r->x); break;
+	case DEY: r->y--; setnz(r, r->y); break;
+
+	case CLC: r->p &= ~FLAG_C; break;
+	case SEC: r->p |= FLAG_C; break;
+	case CLI: r->p &= ~FLAG_I; break;
+	case SEI: r->p |= FLAG_I; break;
+	case CLD: r->p &= ~FLAG_D; break;
+	case SED: r->p |= FLAG_D; break;
+	case CLV: r->p &= ~FLAG_V; break;
+	case NOP: break;
+
+	case PHA: push(r, r->a); break;
+	case PHP: push(r, r->p | FLAG_B | 0x20); break;
+	case PLA: r->a = pull(r); setnz(r, r->a); break;
+	case PLP: r->p = (pull(r) & ~FLAG_B) | 0x20; break;
+
+	case BPL: case BMI: case BVC: case BVS: case BCC: case BCS: case BNE: case BEQ:
+	    {
+		bool taken = false;
+
+		switch(op)
+		    {
+		    case BPL: taken = !(r->p & FLAG_N); break;
+		    case BMI: taken = r->p & FLAG_N; break;
+		    case BVC: taken = !(r->p & FLAG_V); break;
+		    case BVS: taken = r->p & FLAG_V; break;
+		    case BCC: taken = !(r->p & FLAG_C); break;
+		    case BCS: taken = r->p & FLAG_C; break;
+		    case BNE: taken = !(r->p & FLAG_Z); break;
+		    case BEQ: taken = r->p & FLAG_Z; break;
+		    }
+		if(taken)
+		    {
+			r->cycles += ((r->pc ^ address) & 0xff00) ? 2 : 1;
+			r->pc = address;
+		    }
+	    }
+	    break;
+
+	case JMP: r->pc = address; break;
+	case JSR:
+	    push(r, (r->pc - 1) >> 8); //The address of JSR's last byte
+	    push(r, (r->pc - 1) & 0xff);
+	    r->pc = address;
+	    break;
+	case RTS:
+	    r->pc = pull(r);
+	    r->pc |= pull(r) << 8;
+	    r->pc++;
+	    break;
+	case RTI:
+	    r->p = (pull(r) & ~FLAG_B) | 0x20;
+	    r->pc = pull(r);
+	    r->pc |= pull(r) << 8;
+	    break;
+	case BRK:
+	    r->pc++; //BRK skips a padding byte
+	    push(r, r->pc >> 8);
+	    push(r, r->pc & 0xff);
+	    push(r, r->p | FLAG_B | 0x20);
+	    r->p |= FLAG_I;
+	    r->pc = read16(r, 0xfffe);
+	    break;
+	}
+
+    return true;
+}
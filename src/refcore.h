@@ -0,0 +1,55 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef REFCORE_H_INCLUDED
+#define REFCORE_H_INCLUDED
+
+/*
+ * A second, deliberately plain NMOS 6502 for differential testing (See difftest.c). It shares no code with the
+ * real core: plain addresses instead of swapped words, one opcode table laid out like the datasheet, flags kept
+ * as the status byte, decimal mode done the way the NMOS chip is documented to. It's slow and meant to stay
+ * obviously right. Only the documented opcodes; refstep() refuses anything else
+ */
+
+#define REF_WRITES 4 //Most writes one instruction makes (BRK makes 3)
+
+struct REFCPU
+{
+    uint8_t a, x, y, s;
+    uint8_t p; //NV-BDIZC, bit 5 always set
+    uint16_t pc;
+    unsigned long cycles; //Exact, page crossings and taken branches included
+
+    uint16_t writes[REF_WRITES]; //Addresses the last instruction wrote
+    int nwrites;
+
+    uint8_t mem[0x10000];
+};
+
+void refreset(struct REFCPU* r); //Registers as after reset, PC from the vector. Memory is left alone
+bool refstep(struct REFCPU* r); //One instruction. False (And nothing done) for an opcode it doesn't know
+
+#endif // REFCORE_H_INCLUDED
@@ -0,0 +1,414 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "6502.h"
+#include "rewind.h"
+
+static bool grow(void** log, size_t* cap, size_t used, size_t size)
+{
+    void* bigger;
+
+    if(used < *cap) return true;
+
+    bigger = realloc(*log, (*cap ? *cap * 2 : 256) * size);
+    if(!bigger) return false;
+    *log = bigger;
+    *cap = *cap ? *cap * 2 : 256;
+    return true;
+}
+
+static byte rewindread(word address)
+{
+    struct REWIND* r = iodata;
+    byte data;
+    size_t i;
+
+    if(cycles < r->frontier)
+	{
+	    while(r->readpos < r->nreads && r->reads[r->readpos].cycle < cycles) r->readpos++; //Polls this run skipped over
+	    if(r->readpos < r->nreads && r->reads[r->readpos].cycle == cycles && r->reads[r->readpos].address == address)
+		{
+		    return r->reads[r->readpos++].data;
+		}
+
+	    //A poll from an idle loop the recording skipped over. Those only read PAGE_STABLE pages, so the last value still holds
+	    for(i = r->readpos; i-- > 0;)
+		{
+		    if(r->reads[i].address == address) return r->reads[i].data;
+		}
+	    return 0xff;
+	}
+
+    iodata = r->hostdata; //The host's handlers may use it too
+    data = r->hostread(address);
+    iodata = r;
+    if(!grow((void**) &(r->reads), &(r->readcap), r->nreads, sizeof(struct IOREAD)))
+	{
+	    r->lost = true;
+	    return data;
+	}
+
+    r->reads[r->nreads++] = (struct IOREAD) { .cycle = cycles, .address = address, .data = data };
+    r->readpos = r->nreads;
+    return data;
+}
+
+static void rewindwrite(word address, byte data)
+{
+    struct REWIND* r = iodata;
+
+    if(cycles < r->frontier) return; //The device had this one the first time round
+    iodata = r->hostdata;
+    r->hostwrite(address, data);
+    iodata = r;
+}
+
+static void unref(struct SNAPSHOT* s)
+{
+    int i;
+
+    for(i = 0; i < 256; i++)
+	{
+	    if(s->pages[i] && --(s->pages[i]->refs) == 0) free(s->pages[i]);
+	}
+}
+
+static struct SNAPSHOT* newest(struct REWIND* r)
+{
+    return r->count ? &(r->ring[(r->first + r->count - 1) % r->slots]) : NULL;
+}
+
+static void dropoldest(struct REWIND* r)
+{
+    struct SNAPSHOT* s;
+    size_t reads, events;
+    int i;
+
+    unref(&(r->ring[r->first]));
+    r->first = (r->first + 1) % r->slots;
+    r->count--;
+    if(!r->count) return;
+
+    //Trim the logs to what the oldest checkpoint left needs, once that's at least half of them
+    s = &(r->ring[r->first]);
+    reads = s->reads;
+    events = s->events;
+    if(reads * 2 < r->nreads && events * 2 < r->nevents) return;
+
+    memmove(r->reads, r->reads + reads, (r->nreads - reads) * sizeof(struct IOREAD));
+    memmove(r->events, r->events + events, (r->nevents - events) * sizeof(struct IRQEVENT));
+    r->nreads -= reads;
+    r->readpos -= reads;
+    r->nevents -= events;
+    r->eventpos -= events;
+    for(i = 0; i < r->count; i++)
+	{
+	    s = &(r->ring[(r->first + i) % r->slots]);
+	    s->reads -= reads;
+	    s->events -= events;
+	}
+}
+
+/*
+ * Pages are compared with the last checkpoint rather than trusting dirty[], which savestate() and the fuzzer clear
+ * on their own schedule. It's 64 KiB of memcmp() per checkpoint, and catches pages written back with the same data
+ */
+static bool snapshot(struct REWIND* r)
+{
+    struct SNAPSHOT* last;
+    struct SNAPSHOT* s;
+    int i;
+
+    if(r->count == r->slots) dropoldest(r);
+    last = newest(r);
+    s = &(r->ring[(r->first + r->count) % r->slots]);
+
+    for(i = 0; i < 256; i++)
+	{
+	    const byte* page = getpage(BtoW(0, i));
+
+	    s->pages[i] = NULL;
+	    if(pageflags[i] & PAGE_IO) continue;
+
+	    if(last && last->pages[i] && memcmp(last->pages[i]->data, page, 0x100) == 0)
+		{
+		    s->pages[i] = last->pages[i];
+		    s->pages[i]->refs++;
+		    continue;
+		}
+
+	    s->pages[i] = malloc(sizeof(struct SNAPPAGE));
+	    if(!s->pages[i])
+		{
+		    unref(s);
+		    return false;
+		}
+	    s->pages[i]->refs = 1;
+	    memcpy(s->pages[i]->data, page, 0x100);
+	}
+
+    s->registers = registers;
+    s->cycles = cycles;
+    s->reads = r->readpos;
+    s->events = r->eventpos;
+    r->count++;
+    return true;
+}
+
+static void restore(struct REWIND* r, const struct SNAPSHOT* s)
+{
+    int i;
+
+    for(i = 0; i < 256; i++)
+	{
+	    byte* page;
+
+	    if(!s->pages[i] || memcmp(getpage(BtoW(0, i)), s->pages[i]->data, 0x100) == 0) continue;
+
+	    if((pageflags[i] & PAGE_CODE) && codewrite) codewrite(BtoW(0, i), 0x100); //The whole page changes
+	    page = writepage(BtoW(0, i));
+	    if(page) memcpy(page, s->pages[i]->data, 0x100);
+	}
+
+    registers = s->registers;
+    cycles = s->cycles;
+    r->readpos = s->reads;
+    r->eventpos = s->events;
+}
+
+static int find(struct REWIND* r, unsigned long before) //Newest checkpoint older than the cycle, or -1
+{
+    int i;
+
+    for(i = r->count - 1; i >= 0; i--)
+	{
+	    if(r->ring[(r->first + i) % r->slots].cycles < before) return i;
+	}
+
+    return -1;
+}
+
+static struct SNAPSHOT* slot(struct REWIND* r, int i)
+{
+    return &(r->ring[(r->first + i) % r->slots]);
+}
+
+static void deliver(struct REWIND* r) //Raises the logged interrupts that are due
+{
+    while(r->eventpos < r->nevents && r->events[r->eventpos].cycle <= cycles)
+	{
+	    interrupt(r->events[r->eventpos].type);
+	    r->eventpos++;
+	}
+}
+
+static void step(struct REWIND* r) //One instruction, and whatever the host raised after it
+{
+    if(busexact) nextbus();
+    else next();
+    deliver(r);
+}
+
+static void replay(struct REWIND* r, unsigned long end)
+{
+    unsigned long event = nextevent;
+
+    nextevent = 0; //The devices are already past all of this
+    while(cycles < end)
+	{
+	    unsigned long stop = end;
+
+	    deliver(r);
+	    if(r->eventpos < r->nevents && r->events[r->eventpos].cycle < stop) stop = r->events[r->eventpos].cycle;
+	    run(stop - cycles);
+	}
+    deliver(r);
+    nextevent = event;
+}
+
+bool rewindopen(struct REWIND* r, int slots, unsigned long interval)
+{
+    memset(r, 0, sizeof(struct REWIND));
+    if(slots < 1 || !interval) return false;
+
+    r->ring = calloc(slots, sizeof(struct SNAPSHOT));
+    if(!r->ring) return false;
+    r->slots = slots;
+    r->interval = interval;
+    r->frontier = cycles;
+
+    if(!snapshot(r))
+	{
+	    free(r->ring);
+	    return false;
+	}
+    r->due = cycles + interval;
+
+    r->hostread = ioread;
+    r->hostwrite = iowrite;
+    r->hostdata = iodata;
+    ioread = &(rewindread);
+    iowrite = &(rewindwrite);
+    iodata = r;
+    return true;
+}
+
+void rewindclose(struct REWIND* r)
+{
+    while(r->count) dropoldest(r);
+    free(r->ring);
+    free(r->reads);
+    free(r->events);
+
+    ioread = r->hostread;
+    iowrite = r->hostwrite;
+    iodata = r->hostdata;
+    memset(r, 0, sizeof(struct REWIND));
+}
+
+unsigned long rewindrun(struct REWIND* r, unsigned long n)
+{
+    unsigned long begin = cycles;
+    unsigned long end = cycles + n;
+
+    if(cycles < r->frontier)
+	{
+	    replay(r, (end < r->frontier) ? end : r->frontier);
+	    if(cycles >= end) return cycles - begin;
+	}
+    r->readpos = r->nreads; //Live from here
+
+    while(cycles < end)
+	{
+	    unsigned long stop = end;
+
+	    if(cycles >= r->due)
+		{
+		    if(!snapshot(r)) r->lost = true;
+		    r->due = cycles + r->interval;
+		}
+	    if(r->due < stop) stop = r->due;
+
+	    if(!run(stop - cycles)) break; //Stopped at nextevent
+	    r->frontier = cycles;
+	}
+
+    return cycles - begin;
+}
+
+void rewindinterrupt(struct REWIND* r, int type)
+{
+    if(cycles < r->frontier) rewinddiscard(r);
+
+    if(!grow((void**) &(r->events), &(r->eventcap), r->nevents, sizeof(struct IRQEVENT))) r->lost = true;
+    else
+	{
+	    r->events[r->nevents++] = (struct IRQEVENT) { .cycle = cycles, .type = type };
+	    r->eventpos = r->nevents;
+	}
+
+    interrupt(type);
+}
+
+void rewinddiscard(struct REWIND* r)
+{
+    while(r->count > 1 && newest(r)->cycles > cycles)
+	{
+	    unref(newest(r));
+	    r->count--;
+	}
+
+    r->nreads = r->readpos;
+    r->nevents = r->eventpos;
+    r->frontier = cycles;
+    r->due = newest(r)->cycles + r->interval;
+}
+
+bool rewindto(struct REWIND* r, unsigned long cycle)
+{
+    int i = find(r, cycle + 1);
+
+    if(r->lost || i < 0) return false;
+    if(cycle > r->frontier) cycle = r->frontier;
+
+    restore(r, slot(r, i));
+    replay(r, cycle);
+    return true;
+}
+
+bool reversestep(struct REWIND* r)
+{
+    unsigned long now = cycles;
+    unsigned long last;
+    int i = find(r, now);
+
+    if(r->lost || i < 0) return false;
+
+    //The previous instruction can only be found going forward, so run up to now once to find where it started
+    restore(r, slot(r, i));
+    last = cycles;
+    while(cycles < now)
+	{
+	    last = cycles;
+	    step(r);
+	}
+
+    return rewindto(r, last);
+}
+
+bool reversecontinue(struct REWIND* r, word address)
+{
+    unsigned long now = cycles;
+    unsigned long end = now;
+    int i;
+
+    if(r->lost) return false;
+
+    //Search one checkpoint interval at a time, newest first, and keep the last hit in each
+    for(i = find(r, now); i >= 0; i--)
+	{
+	    unsigned long hit = 0;
+	    bool found = false;
+
+	    restore(r, slot(r, i));
+	    while(cycles < end)
+		{
+		    if(registers.pc == address)
+			{
+			    hit = cycles;
+			    found = true;
+			}
+		    step(r);
+		}
+
+	    if(found) return rewindto(r, hit);
+	    end = slot(r, i)->cycles;
+	}
+
+    rewindto(r, now); //Never got there, so put things back
+    return false;
+}
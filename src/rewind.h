@@ -0,0 +1,110 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "6502.h"
+
+#ifndef REWIND_H_INCLUDED
+#define REWIND_H_INCLUDED
+
+/*
+ * Reverse execution. While the host drives the CPU through rewindrun(), a checkpoint of the registers and
+ * memory is kept every interval cycles in a ring of the last few, with pages that didn't change shared between
+ * checkpoints. Every I/O read and every interrupt the host raises is logged with its cycle, so going back is
+ * restoring the nearest checkpoint and running forward again with the log standing in for the devices.
+ *
+ * Devices aren't rewound: while the CPU is behind the furthest cycle it reached (The frontier), reads come from
+ * the log and writes are dropped, since the devices saw them the first time. Running forward again replays up to
+ * the frontier and carries on live from there. Set ioread/iowrite, the variant and the bus mode before rewindopen(),
+ * and don't change them or call run()/next()/interrupt() directly until rewindclose()
+ */
+
+struct SNAPPAGE //One page of a checkpoint, shared by every checkpoint where it has the same contents
+{
+    int refs;
+    byte data[0x100];
+};
+
+struct SNAPSHOT
+{
+    struct CPUREGS registers;
+    unsigned long cycles;
+    size_t reads; //Where the logs were at this cycle
+    size_t events;
+    struct SNAPPAGE* pages[256]; //NULL for I/O pages
+};
+
+struct IOREAD
+{
+    unsigned long cycle;
+    word address;
+    byte data;
+};
+
+struct IRQEVENT
+{
+    unsigned long cycle;
+    int type; //As for interrupt()
+};
+
+struct REWIND
+{
+    struct SNAPSHOT* ring;
+    int slots; //Checkpoints kept, the oldest is dropped for a new one
+    int first; //Oldest checkpoint in the ring
+    int count;
+
+    unsigned long interval;
+    unsigned long due; //Cycle of the next checkpoint
+    unsigned long frontier; //Furthest cycle run so far
+
+    struct IOREAD* reads;
+    size_t nreads, readcap, readpos;
+    struct IRQEVENT* events;
+    size_t nevents, eventcap, eventpos;
+    bool lost; //Ran out of memory for the logs, so there's nothing safe to go back to
+
+    byte (*hostread)(word address); //The host's handlers, called while live
+    void (*hostwrite)(word address, byte data);
+    void* hostdata; //The host's iodata
+};
+
+bool rewindopen(struct REWIND* r, int slots, unsigned long interval); //Takes the first checkpoint now
+void rewindclose(struct REWIND* r); //Frees everything and gives the host its I/O handlers back
+
+unsigned long rewindrun(struct REWIND* r, unsigned long n); //run(n), replaying first if the CPU has been rewound
+void rewindinterrupt(struct REWIND* r, int type); //interrupt(), logged. Drops the rewound future if there is one
+void rewinddiscard(struct REWIND* r); //Makes now the frontier, after the host changes state while rewound
+
+/*
+ * Going back. Each returns false, and leaves the CPU where it was, if the target is older than the oldest checkpoint.
+ * A point in time is an instruction boundary, after any interrupts the host raised there.
+ * rewindto() stops at the first one at or after the cycle
+ */
+bool rewindto(struct REWIND* r, unsigned long cycle);
+bool reversestep(struct REWIND* r); //To the start of the previous instruction
+bool reversecontinue(struct REWIND* r, word address); //To the last time PC was at address (Same byte order as registers.pc)
+
+#endif // REWIND_H_INCLUDED
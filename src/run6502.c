@@ -0,0 +1,249 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+/*
+ * Headless batch runner. Runs every ROM (or every file in a directory) until it hits a trap, on a pool of
+ * worker threads with one CPU each, and prints one line of JSON per ROM in the order they were given.
+ *
+ * Build: cc -O2 -pthread run6502.c batch.c 6502.c buscore.c -o run6502
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "6502.h"
+#include "batch.h"
+
+struct RESULT
+{
+    char* rom;
+    const char* trap; //What stopped it: "write", "brk", "loop", "cycles" or "error"
+    int value; //Byte written to the trap address
+    struct CPUREGS regs;
+    unsigned long cycles;
+    uint32_t crc;
+};
+
+//Options, shared by every worker
+static unsigned long org = 0x10000; //0x10000 means "end the ROM at the top of memory"
+static long resetvector = -1;
+static long trapaddr = -1;
+static bool trapbrk = false;
+static unsigned long limit = 100000000;
+static int cpuvariant = CPU_NMOS;
+
+static struct RESULT* results;
+static int count;
+static atomic_int nextrom;
+
+static CPU_LOCAL byte* mem; //Each worker's memory, mapped into its memorymap
+static CPU_LOCAL int written = -1; //Byte written to the trap address, -1 until then
+
+static byte trapread(word address)
+{
+    return mem[BIG(address)];
+}
+
+static void trapwrite(word address, byte data)
+{
+    mem[BIG(address)] = data;
+    if(BIG(address) == trapaddr) written = data;
+}
+
+static uint32_t crc32(const byte* data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    size_t i;
+    int j;
+
+    for(i = 0; i < len; i++)
+	{
+	    crc ^= data[i];
+	    for(j = 0; j < 8; j++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+    return ~crc;
+}
+
+static void runrom(struct RESULT* r)
+{
+    int i;
+
+    memset(mem, 0, 0x10000);
+    memorymap.zero = mem;
+    memorymap.stack = mem + 0x100;
+    for(i = 0; i < 254; i++) memorymap.pages[i] = mem + 0x200 + 0x100 * i;
+
+    if(!loadrom(r->rom, mem, org))
+	{
+	    r->trap = "error";
+	    return;
+	}
+
+    if(resetvector >= 0)
+	{
+	    mem[0xfffc] = resetvector & 0xff;
+	    mem[0xfffd] = resetvector >> 8;
+	}
+
+    memset(pageflags, 0, sizeof(pageflags));
+    if(trapaddr >= 0)
+	{
+	    pageflags[trapaddr >> 8] = PAGE_IO;
+	    ioread = &(trapread);
+	    iowrite = &(trapwrite);
+	}
+
+    written = -1;
+    cycles = 0;
+    nextevent = 0;
+    setvariant(cpuvariant);
+    registers.p = BtoP(0x24);
+    reset();
+
+    r->trap = "cycles";
+    while(cycles < limit)
+	{
+	    word pc = registers.pc;
+
+	    if(trapbrk && readb(pc) == 0x00)
+		{
+		    r->trap = "brk";
+		    break;
+		}
+
+	    next();
+
+	    if(written >= 0)
+		{
+		    r->trap = "write";
+		    r->value = written;
+		    break;
+		}
+	    if(registers.pc == pc) //JMP * or a branch to itself. Nothing can get it out without an interrupt
+		{
+		    r->trap = "loop";
+		    break;
+		}
+	}
+
+    r->regs = registers;
+    r->cycles = cycles;
+    r->crc = crc32(mem, 0x10000);
+}
+
+static void* worker(void* arg)
+{
+    int i;
+
+    mem = malloc(0x10000);
+    if(!mem) return NULL;
+
+    while((i = atomic_fetch_add(&nextrom, 1)) < count) runrom(&(results[i]));
+
+    free(mem);
+    return NULL;
+}
+
+static void addrom(const char* path) //For addroms()
+{
+    results = realloc(results, (count + 1) * sizeof(struct RESULT));
+    memset(&(results[count]), 0, sizeof(struct RESULT));
+    results[count].rom = strdup(path);
+    results[count].trap = "error";
+    count++;
+}
+
+static void printjson(const struct RESULT* r)
+{
+
+    printf("{\"rom\":");
+    printquoted(r->rom);
+    printf(",\"trap\":\"%s\"", r->trap);
+    if(strcmp(r->trap, "error") == 0)
+	{
+	    printf("}\n");
+	    return;
+	}
+    if(strcmp(r->trap, "write") == 0) printf(",\"value\":%d", r->value);
+
+    printf(",\"pc\":%u,\"a\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"p\":%u,\"cycles\":%lu,\"crc32\":\"%08x\"}\n",
+	   BIG(r->regs.pc), r->regs.ac, r->regs.x, r->regs.y, r->regs.sp, PtoB(r->regs.p, 1), r->cycles, r->crc);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+	    "usage: run6502 [options] rom|directory...\n"
+	    "  -o addr     load address (hex, default: end at 0xffff)\n"
+	    "  -r addr     reset vector (hex)\n"
+	    "  -t addr     stop on a write to addr (hex)\n"
+	    "  -b          stop on BRK\n"
+	    "  -c cycles   stop after this many cycles (default 100000000)\n"
+	    "  -v variant  0 = NMOS, 1 = NMOS with undocumented opcodes, 2 = 65C02\n"
+	    "  -j threads  worker threads (default: one per CPU)\n"
+	    "Also stops when the program jumps or branches to itself.\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, i, failed = 0;
+
+    while((opt = getopt(argc, argv, "o:r:t:bc:v:j:")) != -1)
+	{
+	    switch(opt)
+		{
+		case 'o': org = addressarg(optarg, '\0'); break;
+		case 'r': resetvector = addressarg(optarg, '\0'); break;
+		case 't': trapaddr = addressarg(optarg, '\0'); break;
+		case 'b': trapbrk = true; break;
+		case 'c': limit = strtoul(optarg, NULL, 10); break;
+		case 'v': cpuvariant = atoi(optarg); break;
+		case 'j': threads = atoi(optarg); break;
+		default: usage();
+		}
+	}
+    if(optind >= argc) usage();
+
+    for(i = optind; i < argc; i++) addroms(argv[i], &(addrom));
+
+    if(threads < 1) threads = 1;
+    if(threads > count) threads = count;
+
+    runpool(threads, &(worker));
+
+    for(i = 0; i < count; i++)
+	{
+	    printjson(&(results[i]));
+	    if(strcmp(results[i].trap, "error") == 0) failed++;
+	}
+
+    return failed ? 1 : 0;
+}
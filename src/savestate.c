@@ -0,0 +1,226 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "6502.h"
+#include "savestate.h"
+
+#define HEADER_SIZE 24
+#define PAGE_MAX (3 + 0x200) //Worst case for one page: its header, then alternating bytes cost the code 3 bytes for every 2
+
+static const byte zeros[0x100];
+
+static int encode(const byte* delta, byte* out) //Zero run, literal run, literals... Returns the length
+{
+    int i = 0, len = 0;
+
+    while(i < 0x100)
+	{
+	    int zero = 0, literal = 0;
+
+	    while(i + zero < 0x100 && zero < 0xff && delta[i + zero] == 0) zero++;
+	    i += zero;
+	    while(i + literal < 0x100 && literal < 0xff && delta[i + literal] != 0) literal++;
+
+	    out[len++] = zero;
+	    out[len++] = literal;
+	    memcpy(out + len, delta + i, literal);
+	    len += literal;
+	    i += literal;
+	}
+
+    return len;
+}
+
+static bool decode(const byte* in, int len, byte* delta)
+{
+    int i = 0, pos = 0;
+
+    while(pos + 2 <= len)
+	{
+	    int zero = in[pos], literal = in[pos + 1];
+
+	    pos += 2;
+	    if(i + zero + literal > 0x100 || pos + literal > len) return false;
+	    memset(delta + i, 0, zero);
+	    i += zero;
+	    memcpy(delta + i, in + pos, literal);
+	    i += literal;
+	    pos += literal;
+	}
+
+    return i == 0x100 && pos == len;
+}
+
+static bool writeall(int fd, const byte* buf, size_t len)
+{
+    while(len)
+	{
+	    ssize_t n = write(fd, buf, len);
+
+	    if(n < 0 && errno == EINTR) continue;
+	    if(n <= 0) return false;
+	    buf += n;
+	    len -= n;
+	}
+
+    return true;
+}
+
+static bool readall(int fd, byte* buf, size_t len)
+{
+    while(len)
+	{
+	    ssize_t n = read(fd, buf, len);
+
+	    if(n < 0 && errno == EINTR) continue;
+	    if(n <= 0) return false;
+	    buf += n;
+	    len -= n;
+	}
+
+    return true;
+}
+
+void checkpoint()
+{
+    memset(dirty, 0, sizeof(dirty));
+}
+
+bool savestate(int fd, const byte* base, int flags)
+{
+    byte* buf = malloc(HEADER_SIZE + 0x100 * PAGE_MAX);
+    size_t len = HEADER_SIZE;
+    int pages = 0, i, j;
+    bool ok;
+
+    if(!buf) return false;
+
+    for(i = 0; i < 0x100; i++)
+	{
+	    const byte* page;
+	    const byte* from;
+	    byte delta[0x100];
+
+	    if(!dirty[i]) continue;
+
+	    page = getpage(BtoW(0, i));
+	    from = base ? base + 0x100 * i : zeros;
+	    for(j = 0; j < 0x100; j++) delta[j] = page[j] ^ from[j];
+
+	    buf[len] = i;
+	    if(flags & SAVE_COMPRESS)
+		{
+		    int n = encode(delta, buf + len + 3);
+
+		    buf[len + 1] = n & 0xff;
+		    buf[len + 2] = n >> 8;
+		    len += 3 + n;
+		}
+	    else
+		{
+		    buf[len + 1] = 0;
+		    buf[len + 2] = 1; //0x100
+		    memcpy(buf + len + 3, delta, 0x100);
+		    len += 3 + 0x100;
+		}
+	    pages++;
+	}
+
+    memcpy(buf, "F652", 4);
+    buf[4] = SAVESTATE_VERSION;
+    buf[5] = flags;
+    buf[6] = pages & 0xff;
+    buf[7] = pages >> 8;
+    buf[8] = BIG(registers.pc) & 0xff;
+    buf[9] = BIG(registers.pc) >> 8;
+    buf[10] = registers.sp;
+    buf[11] = registers.ac;
+    buf[12] = registers.x;
+    buf[13] = registers.y;
+    buf[14] = PtoB(registers.p, 1);
+    buf[15] = variant;
+    for(i = 0; i < 8; i++) buf[16 + i] = (cycles >> (8 * i)) & 0xff;
+
+    ok = writeall(fd, buf, len);
+    free(buf);
+
+    if(ok) checkpoint();
+    return ok;
+}
+
+bool loadstate(int fd, const byte* base)
+{
+    byte header[HEADER_SIZE];
+    byte delta[0x100];
+    int pages, i, j;
+
+    if(!readall(fd, header, HEADER_SIZE)) return false;
+    if(memcmp(header, "F652", 4) != 0 || header[4] != SAVESTATE_VERSION) return false;
+
+    pages = header[6] + (header[7] << 8);
+    for(i = 0; i < pages; i++)
+	{
+	    byte info[3];
+	    int len;
+	    byte* page;
+	    const byte* from;
+
+	    if(!readall(fd, info, 3)) return false;
+	    len = info[1] + (info[2] << 8);
+	    if(len > PAGE_MAX) return false;
+
+	    if(header[5] & SAVE_COMPRESS)
+		{
+		    byte code[PAGE_MAX];
+
+		    if(!readall(fd, code, len) || !decode(code, len, delta)) return false;
+		}
+	    else if(len != 0x100 || !readall(fd, delta, 0x100)) return false;
+
+	    if((pageflags[info[0]] & PAGE_CODE) && codewrite) codewrite(BtoW(0, info[0]), 0x100); //The whole page changes
+	    page = writepage(BtoW(0, info[0]));
+	    if(!page) return false;
+	    from = base ? base + 0x100 * info[0] : zeros;
+	    for(j = 0; j < 0x100; j++) page[j] = delta[j] ^ from[j];
+	}
+
+    registers.pc = LITTLE(header[8] + (header[9] << 8));
+    registers.sp = header[10];
+    registers.ac = header[11];
+    registers.x = header[12];
+    registers.y = header[13];
+    registers.p = BtoP(header[14]);
+    setvariant(header[15]);
+    cycles = 0;
+    for(i = 0; i < 8; i++) cycles |= (unsigned long) header[16 + i] << (8 * i);
+
+    checkpoint(); //Memory matches the save now
+    return true;
+}
@@ -0,0 +1,53 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+
+#include "6502.h"
+
+#ifndef SAVESTATE_H_INCLUDED
+#define SAVESTATE_H_INCLUDED
+
+/*
+ * Incremental save states. A save holds the registers and every page written since the last save (Or the
+ * last checkpoint()), each stored as the XOR against a base image the host keeps, such as the ROM as loaded.
+ * To restore, start from the base and load the saves in the order they were written.
+ *
+ * Layout (Little endian):
+ *   "F652", version, flags, page count (2 bytes)
+ *   pc (2), sp, ac, x, y, p, variant, cycles (8)
+ *   For each page: page number, payload length (2), payload
+ * With SAVE_COMPRESS the payload is a run-length code for XOR deltas, which are mostly zeros:
+ * pairs of (zero count, literal count) bytes, each followed by its literals. Otherwise it's the 256 raw bytes
+ */
+
+#define SAVESTATE_VERSION 1
+
+#define SAVE_COMPRESS 0x1
+
+void checkpoint(); //Forget which pages are dirty, without saving them
+
+bool savestate(int fd, const byte* base, int flags); //base is 64 KiB, or NULL for all zeros. Clears the dirty pages
+bool loadstate(int fd, const byte* base);
+
+#endif // SAVESTATE_H_INCLUDED
@@ -0,0 +1,195 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "6502.h"
+#include "system.h"
+
+static void runto(struct SYSTEM* s, int i, unsigned long target) //With CPU i loaded
+{
+    while(cycles < target)
+	{
+	    if(nextevent && nextevent <= cycles)
+		{
+		    if(s->event[i]) s->event[i](i);
+		    if(nextevent && nextevent <= cycles) //Nothing moved it, so the CPU is held (Like RDY) until the next round
+			{
+			    cycles = target; //Time still passes, so it stays level with the system clock
+			    break;
+			}
+		}
+
+	    run(target - cycles);
+	}
+}
+
+static bool sharing(const struct SYSTEM* s) //Any CPU with a PAGE_SHARED page, which rules out threaded rounds
+{
+    int i, j;
+
+    for(i = 0; i < s->count; i++)
+	{
+	    for(j = 0; j < 256; j++) if(s->cpus[i]->pageflags[j] & PAGE_SHARED) return true;
+	}
+
+    return false;
+}
+
+static void* worker(void* arg)
+{
+    struct WORKER* w = arg;
+    struct SYSTEM* s = w->system;
+
+    pthread_mutex_lock(&(s->lock)); //Held until every worker has started, or one couldn't
+    pthread_mutex_unlock(&(s->lock));
+    if(s->quit) return NULL;
+
+    while(true)
+	{
+	    pthread_barrier_wait(&(s->start));
+	    if(s->quit) break;
+
+	    loadcontext(s->cpus[w->cpu]);
+	    runto(s, w->cpu, s->target);
+	    savecontext(s->cpus[w->cpu]);
+
+	    pthread_barrier_wait(&(s->done));
+	}
+
+    return NULL;
+}
+
+void systeminit(struct SYSTEM* s, unsigned long minquantum, unsigned long maxquantum)
+{
+    memset(s, 0, sizeof(struct SYSTEM));
+    s->minquantum = minquantum ? minquantum : 1;
+    s->maxquantum = (maxquantum > s->minquantum) ? maxquantum : s->minquantum;
+    s->quantum = s->minquantum; //Nothing's known about the CPUs yet
+}
+
+int systemadd(struct SYSTEM* s, struct CPUCONTEXT* c, void (*event)(int cpu))
+{
+    if(s->count == SYSTEM_MAX || s->threaded) return -1;
+
+    c->cycles = s->time;
+    s->cpus[s->count] = c;
+    s->event[s->count] = event;
+    return s->count++;
+}
+
+bool systemthreads(struct SYSTEM* s, bool on)
+{
+    int i;
+
+    if(on == s->threaded) return true;
+
+    if(!on)
+	{
+	    s->quit = true;
+	    pthread_barrier_wait(&(s->start));
+	    for(i = 0; i < s->count; i++) pthread_join(s->workers[i].thread, NULL);
+	    pthread_barrier_destroy(&(s->start));
+	    pthread_barrier_destroy(&(s->done));
+	    pthread_mutex_destroy(&(s->lock));
+	    s->threaded = false;
+	    return true;
+	}
+
+    if(s->count < 2 || sharing(s)) return false; //Nothing to run alongside, or CPUs that would race on memory
+
+    pthread_mutex_init(&(s->lock), NULL);
+    pthread_mutex_lock(&(s->lock));
+    s->quit = false;
+    for(i = 0; i < s->count; i++)
+	{
+	    s->workers[i].system = s;
+	    s->workers[i].cpu = i;
+	    if(pthread_create(&(s->workers[i].thread), NULL, &(worker), &(s->workers[i]))) break;
+	}
+
+    if(i < s->count || pthread_barrier_init(&(s->start), NULL, s->count + 1)) s->quit = true;
+    else if(pthread_barrier_init(&(s->done), NULL, s->count + 1))
+	{
+	    pthread_barrier_destroy(&(s->start));
+	    s->quit = true;
+	}
+
+    pthread_mutex_unlock(&(s->lock));
+    if(s->quit)
+	{
+	    while(i--) pthread_join(s->workers[i].thread, NULL);
+	    pthread_mutex_destroy(&(s->lock));
+	    return false;
+	}
+
+    s->threaded = true;
+    return true;
+}
+
+unsigned long systemrun(struct SYSTEM* s, unsigned long n)
+{
+    unsigned long begin = s->time;
+    unsigned long end = s->time + n;
+    int i;
+
+    while(s->time < end)
+	{
+	    unsigned long target = s->time + s->quantum;
+	    bool parallel = s->threaded && !sharing(s); //Checked every round, the host may map a shared page at any time
+
+	    if(target > end) target = end;
+	    for(i = 0; i < s->count; i++) s->cpus[i]->sharedaccesses = 0;
+
+	    if(parallel)
+		{
+		    s->target = target;
+		    pthread_barrier_wait(&(s->start));
+		    pthread_barrier_wait(&(s->done));
+		    s->threadedrounds++;
+		}
+	    else
+		{
+		    for(i = 0; i < s->count; i++)
+			{
+			    loadcontext(s->cpus[i]);
+			    runto(s, i, target);
+			    savecontext(s->cpus[i]);
+			}
+		}
+
+	    s->shared = 0;
+	    for(i = 0; i < s->count; i++) s->shared += s->cpus[i]->sharedaccesses;
+
+	    if(s->shared) s->quantum = s->minquantum; //Talking, so keep them close
+	    else if(s->quantum < s->maxquantum) s->quantum = (s->quantum * 2 < s->maxquantum) ? s->quantum * 2 : s->maxquantum;
+
+	    s->time = target;
+	    s->rounds++;
+	}
+
+    return s->time - begin;
+}
@@ -0,0 +1,96 @@
+/**
+  * Copyright (c) 2014 Aaron Cohen
+  * This file is part of Free6502
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+  */
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "6502.h"
+
+#ifndef SYSTEM_H_INCLUDED
+#define SYSTEM_H_INCLUDED
+
+/*
+ * Machines with more than one 6502 (A computer and its disk drive, coprocessor boards). Each CPU is a
+ * struct CPUCONTEXT, and systemrun() takes them in turn, each running up to the same cycle before the next
+ * one starts, so none is ever more than a quantum ahead of the others. They share memory by pointing
+ * memorymap at the same pages, or talk through I/O handlers, and the host flags those pages PAGE_SHARED.
+ *
+ * The quantum adapts: any shared access in a round drops it to the minimum, so CPUs in conversation are
+ * interleaved tightly, and it doubles back up to the maximum for every quiet round. A CPU whose event handler
+ * leaves nextevent where it was is held there, its clock moving on with the round's, until a later call moves it.
+ *
+ * Threads are only for CPUs that share nothing (Separate machines run in lockstep, a farm of test rigs): while
+ * any CPU has a PAGE_SHARED page, systemthreads() refuses and rounds go back to taking turns on the calling
+ * thread, since two CPUs running at once would race on that page. CPUs that share memory always take turns.
+ *
+ * Everything runs on the CPU of whichever thread it's on, so systemrun() leaves the calling thread's CPU
+ * loaded with the last context it ran. In threaded rounds the I/O handlers are called from the workers
+ */
+
+#define SYSTEM_MAX 8 //CPUs in one system
+
+struct SYSTEM;
+
+struct WORKER
+{
+    struct SYSTEM* system;
+    int cpu;
+    pthread_t thread;
+};
+
+struct SYSTEM
+{
+    struct CPUCONTEXT* cpus[SYSTEM_MAX];
+    void (*event[SYSTEM_MAX])(int cpu); //Called with the CPU loaded when it gets to its nextevent
+    int count;
+
+    unsigned long time; //Every CPU has run at least this far
+    unsigned long quantum; //Cycles per round
+    unsigned long minquantum;
+    unsigned long maxquantum;
+    unsigned long shared; //Shared accesses in the last round
+
+    unsigned long rounds; //For tuning: rounds run, and how many of them were on threads
+    unsigned long threadedrounds;
+
+    bool threaded; //Workers are running
+    bool quit;
+    unsigned long target; //End of the current threaded round
+    struct WORKER workers[SYSTEM_MAX];
+    pthread_mutex_t lock; //Holds the workers back until they've all been started
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+};
+
+void systeminit(struct SYSTEM* s, unsigned long minquantum, unsigned long maxquantum);
+int systemadd(struct SYSTEM* s, struct CPUCONTEXT* c, void (*event)(int cpu)); //Index of the CPU, or -1. Sets its cycles to the system's
+
+/*
+ * Worker threads, one per CPU. Add every CPU first. Turning them off waits for the workers to finish,
+ * and has to be done before the system goes away
+ */
+bool systemthreads(struct SYSTEM* s, bool on); //False if it can't start them, or a CPU has a PAGE_SHARED page
+
+unsigned long systemrun(struct SYSTEM* s, unsigned long n); //Every CPU runs n more cycles
+
+#endif // SYSTEM_H_INCLUDED